@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "math_util.h"
+#ifndef MATH_UTIL_FIXED
+#include "kalman_filter.h"
+#endif
+
+// benchmark of the math_util kernels
+// prints time per call and throughput for growing matrix sizes,
+// throughput should stay roughly flat as the dimension grows.
+// rel err is the error of matmul against a double reference on the same
+// inputs, relative to the largest element, so running the float, double
+// and fixed builds (make bench_backends) shows the cost of each backend's
+// precision.
+// the float and double builds also time one kalman_filter.h kf6 step with the
+// kalman_model_init model
+// against the same step through matrix_t views and the math_util kernels,
+// the fixed-size path kalman_filter.c had before KALMAN_FILTER_DEFINE
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void fill_random(matrix_t *m)
+{
+    for (int j = 0; j < m->numRow * m->numCol; j++)
+        m->data[j] = real_from_float((float)rand() / (float)RAND_MAX - 0.5f);
+}
+
+// exact value of an element in double for every backend
+static double as_double(real_t value)
+{
+#ifdef MATH_UTIL_FIXED
+    return (double)value / (double)(1 << REAL_FRAC_BITS);
+#else
+    return (double)value;
+#endif
+}
+
+// straightforward triple loop in double on the same inputs, the reference
+// for both the optimized kernels and the precision of the backend
+static void matmul_reference(matrix_t *left, matrix_t *right, double *result)
+{
+    for (int row = 0; row < left->numRow; row++)
+    {
+        for (int col = 0; col < right->numCol; col++)
+        {
+            double res = 0.0;
+            for (int i = 0; i < left->numCol; i++)
+                res += as_double(get_value(left, row, i)) * as_double(get_value(right, i, col));
+            result[row * right->numCol + col] = res;
+        }
+    }
+}
+
+// largest error relative to the largest element of the reference
+static double max_rel_error(matrix_t *a, const double *reference)
+{
+    double diff = 0.0, scale = 0.0;
+    for (int j = 0; j < a->numRow * a->numCol; j++)
+    {
+        double d = fabs(as_double(a->data[j]) - reference[j]);
+        if (d > diff)
+            diff = d;
+        if (fabs(reference[j]) > scale)
+            scale = fabs(reference[j]);
+    }
+    return diff / scale;
+}
+
+static void bench_matmul(int n)
+{
+    size_t bytes = (size_t)n * (size_t)n * sizeof(real_t);
+    matrix_t left = {n, n, malloc(bytes)};
+    matrix_t right = {n, n, malloc(bytes)};
+    matrix_t product = {n, n, malloc(bytes)};
+    double *reference = malloc((size_t)n * (size_t)n * sizeof(double));
+    int errorcode = 0;
+
+    fill_random(&left);
+    fill_random(&right);
+    matmul_reference(&left, &right, reference);
+    matmul(&left, &right, &product, &errorcode);
+    double error = max_rel_error(&product, reference);
+
+    // roughly the same amount of work for every size
+    double flops_per_call = 2.0 * (double)n * (double)n * (double)n;
+    long reps = (long)(2e8 / flops_per_call) + 1;
+
+    double start = now_seconds();
+    for (long r = 0; r < reps; r++)
+        matmul(&left, &right, &product, &errorcode);
+    double elapsed = now_seconds() - start;
+
+    double matadd_start = now_seconds();
+    for (long r = 0; r < reps; r++)
+        matadd(&left, &right, &product, &errorcode);
+    double matadd_elapsed = now_seconds() - matadd_start;
+
+    printf("%5d %14.1f %10.3f %14.1f %12.2e\n", n,
+           elapsed / (double)reps * 1e9,
+           flops_per_call * (double)reps / elapsed * 1e-9,
+           matadd_elapsed / (double)reps * 1e9,
+           error);
+
+    free(left.data);
+    free(right.data);
+    free(product.data);
+    free(reference);
+}
+
+#ifndef MATH_UTIL_FIXED
+
+#define BENCH_FILTER_STEPS 200000
+#define BENCH_FILTER_INPUTS 1024
+
+// one step through matrix_t views of kf and the math_util kernels
+static int legacy_step(kf6_t *kf, real_t *u, real_t *z, int *errorcode)
+{
+    matrixView(Fm, kf->F, dimState, dimState);
+    matrixView(Ftm, kf->Ft, dimState, dimState);
+    matrixView(Bm, kf->B, numRowB, numColB);
+    matrixView(Hm, kf->H, numRowH, numColH);
+    matrixView(Htm, kf->Ht, numColH, numRowH);
+    matrixView(Qm, kf->Q, dimState, dimState);
+    matrixView(Rm, kf->R, numRowR, numColR);
+    matrixView(Pm, kf->P, dimState, dimState);
+    vector_t x = {dimState, kf->x}, uv = {numColB, u}, zv = {numRowH, z}, y = {numRowH, kf->y};
+    real_t Id_data[dimState * dimState] = {0};
+    matrixView(Idm, Id_data, dimState, dimState);
+    for (int i = 0; i < dimState; i++)
+        Id_data[i * dimState + i] = 1;
+
+    stackVectorAllocate(Fx, dimState);
+    stackVectorAllocate(Bu, dimState);
+    stackVectorAllocate(x_pred, dimState);
+    stackMatrixAllocate(FP, dimState, dimState);
+    stackMatrixAllocate(FPFt, dimState, dimState);
+    stackMatrixAllocate(P_pred, dimState, dimState);
+    stackVectorAllocate(Hx, numRowH);
+    stackVectorAllocate(Ky, dimState);
+    stackMatrixAllocate(PHt, dimState, numRowH);
+    stackMatrixAllocate(HPHt, numRowH, numRowH);
+    stackMatrixAllocate(Sk, numRowH, numRowH);
+    stackMatrixAllocate(invSk, numRowH, numRowH);
+    stackMatrixAllocate(HtinvSk, dimState, numRowH);
+    stackMatrixAllocate(Kk, dimState, numRowH);
+    stackMatrixAllocate(KH, dimState, dimState);
+    stackMatrixAllocate(IKH, dimState, dimState);
+
+    return matvecmul(&Fm, &x, &Fx, errorcode) && matvecmul(&Bm, &uv, &Bu, errorcode) &&
+           vecadd(&Fx, &Bu, &x_pred, errorcode) && matmul(&Fm, &Pm, &FP, errorcode) &&
+           matmul(&FP, &Ftm, &FPFt, errorcode) && matadd(&FPFt, &Qm, &P_pred, errorcode) &&
+           matvecmul(&Hm, &x_pred, &Hx, errorcode) && vecsub(&zv, &Hx, &y, errorcode) &&
+           matmul(&P_pred, &Htm, &PHt, errorcode) && matmul(&Hm, &PHt, &HPHt, errorcode) &&
+           matadd(&HPHt, &Rm, &Sk, errorcode) && inv3x3(&Sk, &invSk, errorcode) &&
+           matmul(&Htm, &invSk, &HtinvSk, errorcode) && matmul(&P_pred, &HtinvSk, &Kk, errorcode) &&
+           matvecmul(&Kk, &y, &Ky, errorcode) && vecadd(&x_pred, &Ky, &x, errorcode) &&
+           matmul(&Kk, &Hm, &KH, errorcode) && matsub(&Idm, &KH, &IKH, errorcode) &&
+           matmul(&IKH, &P_pred, &Pm, errorcode);
+}
+
+static void bench_filter_step(void)
+{
+    static real_t u[BENCH_FILTER_INPUTS][numColB], z[BENCH_FILTER_INPUTS][numRowH];
+    kf6_t generic, legacy;
+    int errorcode = 0;
+
+    for (int k = 0; k < BENCH_FILTER_INPUTS; k++)
+    {
+        for (int i = 0; i < numColB; i++)
+            u[k][i] = (real_t)rand() / (real_t)RAND_MAX - (real_t)0.5;
+        for (int i = 0; i < numRowH; i++)
+            z[k][i] = (real_t)rand() / (real_t)RAND_MAX - (real_t)0.5;
+    }
+
+    kalman_tuning_t tuning;
+    kalman_default_tuning(&tuning);
+    kalman_model_init(&generic, &tuning);
+    double start = now_seconds();
+    for (int k = 0; k < BENCH_FILTER_STEPS; k++)
+        kf6_iterate(&generic, u[k % BENCH_FILTER_INPUTS], z[k % BENCH_FILTER_INPUTS], &errorcode);
+    double generic_ns = (now_seconds() - start) / BENCH_FILTER_STEPS * 1e9;
+
+    kalman_model_init(&legacy, &tuning);
+    start = now_seconds();
+    for (int k = 0; k < BENCH_FILTER_STEPS; k++)
+        legacy_step(&legacy, u[k % BENCH_FILTER_INPUTS], z[k % BENCH_FILTER_INPUTS], &errorcode);
+    double legacy_ns = (now_seconds() - start) / BENCH_FILTER_STEPS * 1e9;
+
+    double diff = 0.0;
+    for (int i = 0; i < dimState; i++)
+        diff = fmax(diff, fabs(as_double(generic.x[i]) - as_double(legacy.x[i])));
+
+    printf("\nkf6 step, %d steps\n", BENCH_FILTER_STEPS);
+    printf("generic kf6_iterate     %8.1f ns\n", generic_ns);
+    printf("matrix_t views          %8.1f ns\n", legacy_ns);
+    printf("max |x_generic - x_views| = %.2e\n", diff);
+}
+
+#endif
+
+int main(void)
+{
+    int sizes[] = {6, 9, 15, 32, 64, 128, 256};
+    printf("backend: %s\n", REAL_BACKEND_NAME);
+    printf("%5s %14s %10s %14s %12s\n", "n", "matmul ns", "GFLOP/s", "matadd ns", "rel err");
+    for (unsigned long i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        bench_matmul(sizes[i]);
+#ifndef MATH_UTIL_FIXED
+    bench_filter_step();
+#endif
+    return 0;
+}
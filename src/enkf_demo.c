@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "kalman_filter.h"
+#include "kalman_enkf.h"
+#include "flight_sim.h"
+
+/*
+ * Runs the linearized filter and the ensemble Kalman filter over the same
+ * flight and reports the error against the truth and the time per step of
+ * both.
+ *
+ * usage: enkf_demo [-m members] [-j threads] [-n steps] [-s seed]
+ */
+
+#define ENKF_DEMO_DEFAULT_STEPS 4000
+#define ENKF_DEMO_DEFAULT_MEMBERS 256
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void accumulate_error(const real_t *x, const float *truth, double *position_se, double *velocity_se)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        *position_se += (double)((x[i] - truth[i]) * (x[i] - truth[i]));
+        *velocity_se += (double)((x[i + 3] - truth[i + 3]) * (x[i + 3] - truth[i + 3]));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int num_members = ENKF_DEMO_DEFAULT_MEMBERS;
+    int num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int num_steps = ENKF_DEMO_DEFAULT_STEPS;
+    unsigned long seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:j:n:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            num_members = atoi(optarg);
+            break;
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'n':
+            num_steps = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-m members] [-j threads] [-n steps] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    flight_log_t log;
+    if (!flight_sim_generate(&log, num_steps, seed))
+        return 1;
+
+    kalman_tuning_t tuning;
+    kf6_t kf;
+    enkf_t enkf;
+    int errorcode = 0, status = 1;
+    double single_position_se = 0.0, single_velocity_se = 0.0;
+    double enkf_position_se = 0.0, enkf_velocity_se = 0.0;
+
+    kalman_default_tuning(&tuning);
+    kalman_model_init(&kf, &tuning);
+    if (!enkf_init(&enkf, &tuning, num_members, num_threads, seed))
+        goto cleanup;
+
+    double start = now_seconds();
+    for (int k = 0; k < log.num_steps; k++)
+    {
+        flight_step_t *step = &log.steps[k];
+        if (!kalman_step(&kf, &tuning, step->ak, step->zk, step->pressure, &errorcode))
+            goto cleanup;
+        accumulate_error(kf.x, step->truth, &single_position_se, &single_velocity_se);
+    }
+    double single_time = now_seconds() - start;
+
+    start = now_seconds();
+    for (int k = 0; k < log.num_steps; k++)
+    {
+        flight_step_t *step = &log.steps[k];
+        if (!enkf_step(&enkf, step->ak, step->zk, step->pressure, &errorcode))
+        {
+            fprintf(stderr, "enkf_demo: step %d failed with error %d\n", k, errorcode);
+            goto cleanup;
+        }
+        accumulate_error(enkf.x_mean, step->truth, &enkf_position_se, &enkf_velocity_se);
+    }
+    double enkf_time = now_seconds() - start;
+
+    double n = (double)log.num_steps;
+    printf("%d steps, %d members, %d threads\n", log.num_steps, enkf.num_members, enkf.num_threads);
+    printf("                 position RMSE  velocity RMSE  time/step\n");
+    printf("linearized       %10.4f m  %10.4f m/s  %9.0f ns\n", sqrt(single_position_se / n),
+           sqrt(single_velocity_se / n), single_time / n * 1e9);
+    printf("ensemble         %10.4f m  %10.4f m/s  %9.0f ns\n", sqrt(enkf_position_se / n),
+           sqrt(enkf_velocity_se / n), enkf_time / n * 1e9);
+    status = 0;
+
+cleanup:
+    // enkf_free does nothing after a failed enkf_init
+    enkf_free(&enkf);
+    flight_log_free(&log);
+    return status;
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "flight_sim.h"
+#include "sensor_handlers.h"
+
+// flight profile
+#define SIM_BOOST_TIME 4.0f      // s
+#define SIM_BOOST_ACCEL 25.0f    // m/s^2
+#define SIM_DESCENT_RATE -8.0f   // m/s under parachute
+#define SIM_CHUTE_RESPONSE 0.5f  // 1/s
+#define SIM_WIND_ACCEL_STD 0.05f // m/s^2 per step random walk
+
+// xorshift64* generator, deterministic for a given seed on every platform
+static unsigned long long sim_next(unsigned long long *rng)
+{
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+    return *rng * 2685821657736338717ULL;
+}
+
+static float sim_uniform(unsigned long long *rng)
+{
+    // 24 random bits in (0, 1)
+    return ((float)(sim_next(rng) >> 40) + 0.5f) / 16777216.0f;
+}
+
+static float sim_normal(unsigned long long *rng)
+{
+    // Box-Muller
+    float u1 = sim_uniform(rng), u2 = sim_uniform(rng);
+    return sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2);
+}
+
+int flight_sim_generate(flight_log_t *log, int num_steps, unsigned long seed)
+{
+    log->steps = malloc((size_t)num_steps * sizeof(flight_step_t));
+    if (log->steps == NULL)
+    {
+        fprintf(stderr, "flight_sim: could not allocate %d steps\n", num_steps);
+        return 0;
+    }
+    log->num_steps = num_steps;
+    log->has_truth = 1;
+
+    unsigned long long rng = 0x9E3779B97F4A7C15ULL ^ (unsigned long long)seed;
+    float pos[3] = {0.0f}, vel[3] = {0.0f}, wind[2] = {0.0f};
+    int apogee = 0, landed = 0;
+
+    for (int k = 0; k < num_steps; k++)
+    {
+        float t = (float)k * Dt;
+        float acc[3];
+
+        if (landed)
+        {
+            acc[0] = acc[1] = acc[2] = 0.0f;
+        }
+        else if (apogee && pos[2] <= 0.0f)
+        {
+            // touchdown, the impact stops the rocket within one step and
+            // shows up in the measured acceleration like any other
+            for (int i = 0; i < 3; i++)
+                acc[i] = -vel[i] / Dt;
+            landed = 1;
+        }
+        else
+        {
+            wind[0] += SIM_WIND_ACCEL_STD * sim_normal(&rng);
+            wind[1] += SIM_WIND_ACCEL_STD * sim_normal(&rng);
+            acc[0] = wind[0];
+            acc[1] = wind[1];
+
+            if (t < SIM_BOOST_TIME)
+                acc[2] = SIM_BOOST_ACCEL;
+            else if (!apogee)
+                acc[2] = -g;
+            else
+                acc[2] = SIM_CHUTE_RESPONSE * (SIM_DESCENT_RATE - vel[2]);
+        }
+
+        // exact constant acceleration kinematics, the same model as F and B
+        for (int i = 0; i < 3; i++)
+        {
+            pos[i] += vel[i] * Dt + 0.5f * acc[i] * Dt * Dt;
+            vel[i] += acc[i] * Dt;
+        }
+        if (t >= SIM_BOOST_TIME && vel[2] <= 0.0f)
+            apogee = 1;
+
+        flight_step_t *step = &log->steps[k];
+        for (int i = 0; i < 3; i++)
+        {
+            step->truth[i] = pos[i];
+            step->truth[i + 3] = vel[i];
+            step->ak[i] = acc[i] + SIM_ACCEL_STD * sim_normal(&rng);
+        }
+        step->zk[0] = pos[0] + SIM_GNSS_STD * sim_normal(&rng);
+        step->zk[1] = pos[1] + SIM_GNSS_STD * sim_normal(&rng);
+        step->pressure = pressure_at_altitude(pos[2]) + SIM_PRESSURE_STD * sim_normal(&rng);
+        step->zk[2] = altitude(step->pressure);
+    }
+    return 1;
+}
+
+int flight_log_read_csv(flight_log_t *log, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "flight_log: could not open %s\n", path);
+        return 0;
+    }
+
+    int capacity = 1024;
+    log->num_steps = 0;
+    log->has_truth = -1;
+    log->steps = malloc((size_t)capacity * sizeof(flight_step_t));
+
+    char line[512];
+    int line_number = 0;
+    while (log->steps != NULL && fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if (log->num_steps == capacity)
+        {
+            capacity *= 2;
+            flight_step_t *grown = realloc(log->steps, (size_t)capacity * sizeof(flight_step_t));
+            if (grown == NULL)
+            {
+                fprintf(stderr, "flight_log: out of memory reading %s\n", path);
+                fclose(file);
+                flight_log_free(log);
+                return 0;
+            }
+            log->steps = grown;
+        }
+
+        flight_step_t *step = &log->steps[log->num_steps];
+        int fields = sscanf(line, "%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f",
+                            &step->ak[0], &step->ak[1], &step->ak[2],
+                            &step->zk[0], &step->zk[1], &step->zk[2], &step->pressure,
+                            &step->truth[0], &step->truth[1], &step->truth[2],
+                            &step->truth[3], &step->truth[4], &step->truth[5]);
+        int has_truth = fields == 13;
+        if (!(fields == 7 || has_truth) || (log->has_truth >= 0 && log->has_truth != has_truth))
+        {
+            fprintf(stderr, "flight_log: %s:%d: expected 7 or 13 columns consistently\n", path, line_number);
+            fclose(file);
+            flight_log_free(log);
+            return 0;
+        }
+        log->has_truth = has_truth;
+        log->num_steps++;
+    }
+    fclose(file);
+
+    if (log->steps == NULL || log->num_steps == 0)
+    {
+        fprintf(stderr, "flight_log: no steps read from %s\n", path);
+        flight_log_free(log);
+        return 0;
+    }
+    return 1;
+}
+
+void flight_log_free(flight_log_t *log)
+{
+    free(log->steps);
+    log->steps = NULL;
+    log->num_steps = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef FLIGHT_SIM_H
+#define FLIGHT_SIM_H
+
+#include "kalman_config.h"
+
+/*
+ * Flight data for offline runs of the filter: either a deterministic
+ * synthetic rocket flight or a recorded log.
+ *
+ * One step holds everything a filter iteration consumes plus the true state
+ * when it is known. Steps are Dt apart.
+ */
+
+// standard deviations of the simulated sensor noise
+#define SIM_ACCEL_STD 0.35f     // m/s^2, matches accelerometer_variance
+#define SIM_GNSS_STD 0.316f     // m, matches GNSS_x_variance and GNSS_y_variance
+#define SIM_PRESSURE_STD 50.0f  // Pa, matches barometer_variance
+
+typedef struct flight_step
+{
+    float truth[dimState]; // x, y, z, vx, vy, vz
+    float ak[numColB];     // measured earth frame acceleration
+    float zk[numRowH];     // GNSS x, y and barometer altitude
+    float pressure;        // raw barometer pressure
+} flight_step_t;
+
+typedef struct flight_log
+{
+    int num_steps;
+    int has_truth;
+    flight_step_t *steps;
+} flight_log_t;
+
+/**
+ * Simulate num_steps of a boost, coast and parachute descent flight with
+ * sensor noise drawn from a generator seeded with seed. The same seed
+ * always gives the same flight. Returns 0 if the steps could not be allocated.
+ */
+int flight_sim_generate(flight_log_t *log, int num_steps, unsigned long seed);
+
+/**
+ * Read a log with one step per line:
+ *   ax,ay,az,zx,zy,zalt,pressure[,x,y,z,vx,vy,vz]
+ * Lines starting with # are skipped. The truth columns are optional but must
+ * be present on every line or on none. Returns 0 on failure.
+ */
+int flight_log_read_csv(flight_log_t *log, const char *path);
+
+void flight_log_free(flight_log_t *log);
+
+#endif
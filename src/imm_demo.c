@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "kalman_filter.h"
+#include "kalman_imm.h"
+#include "flight_sim.h"
+
+/*
+ * Runs the single filter and the powered/ballistic/parachute IMM bank over
+ * the same flight and reports the error against the truth and the time per
+ * step of both, plus the mode probabilities during the flight.
+ *
+ * usage: imm_demo [-n steps] [-s seed]
+ */
+
+#define IMM_DEMO_DEFAULT_STEPS 4000
+#define IMM_DEMO_PRINT_INTERVAL 100
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void accumulate_error(const real_t *x, const float *truth, double *position_se, double *velocity_se)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        *position_se += (double)((x[i] - truth[i]) * (x[i] - truth[i]));
+        *velocity_se += (double)((x[i + 3] - truth[i + 3]) * (x[i + 3] - truth[i + 3]));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int num_steps = IMM_DEMO_DEFAULT_STEPS;
+    unsigned long seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            num_steps = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n steps] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    flight_log_t log;
+    if (!flight_sim_generate(&log, num_steps, seed))
+        return 1;
+
+    kalman_tuning_t tuning;
+    kf6_t kf;
+    static imm_filter_t imm;
+    int errorcode = 0;
+    double single_position_se = 0.0, single_velocity_se = 0.0;
+    double imm_position_se = 0.0, imm_velocity_se = 0.0;
+
+    kalman_default_tuning(&tuning);
+    kalman_model_init(&kf, &tuning);
+    if (!imm_init_flight_modes(&imm))
+        return 1;
+
+    double start = now_seconds();
+    for (int k = 0; k < log.num_steps; k++)
+    {
+        flight_step_t *step = &log.steps[k];
+        if (!kalman_step(&kf, &tuning, step->ak, step->zk, step->pressure, &errorcode))
+            return 1;
+        accumulate_error(kf.x, step->truth, &single_position_se, &single_velocity_se);
+    }
+    double single_time = now_seconds() - start;
+
+    start = now_seconds();
+    for (int k = 0; k < log.num_steps; k++)
+    {
+        flight_step_t *step = &log.steps[k];
+        if (!imm_step(&imm, step->ak, step->zk, step->pressure, &errorcode))
+            return 1;
+        accumulate_error(imm.x_combined, step->truth, &imm_position_se, &imm_velocity_se);
+        if (k % IMM_DEMO_PRINT_INTERVAL == 0)
+            printf("step %6d  z %9.1f m  mu powered %.3f ballistic %.3f parachute %.3f\n", k, (double)step->truth[2],
+                   (double)imm.mu[IMM_MODE_POWERED], (double)imm.mu[IMM_MODE_BALLISTIC],
+                   (double)imm.mu[IMM_MODE_PARACHUTE]);
+    }
+    double imm_time = now_seconds() - start;
+
+    double n = (double)log.num_steps;
+    printf("\n%d steps\n", log.num_steps);
+    printf("                position RMSE  velocity RMSE  time/step\n");
+    printf("single filter   %10.4f m  %10.4f m/s  %7.0f ns\n", sqrt(single_position_se / n),
+           sqrt(single_velocity_se / n), single_time / n * 1e9);
+    printf("IMM, %d modes    %10.4f m  %10.4f m/s  %7.0f ns\n", imm.num_modes, sqrt(imm_position_se / n),
+           sqrt(imm_velocity_se / n), imm_time / n * 1e9);
+    printf("IMM time is %.1fx the single filter\n", imm_time / single_time);
+
+    flight_log_free(&log);
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <stddef.h>
+#include "kalman_batch.h"
+#include "kalman_filter.h"
+
+_Static_assert(KALMAN_BATCH_STATE_DIM == dimState, "batch state width differs from the filter");
+_Static_assert(KALMAN_BATCH_MEASUREMENT_DIM == numRowH, "batch measurement width differs from the filter");
+_Static_assert(KALMAN_BATCH_CONTROL_DIM == numColB, "batch control width differs from the filter");
+_Static_assert(KALMAN_BATCH_DIMENSION_ERROR == MATMUL_DIMENSION_MISMATCH_ERROR, "batch error codes differ");
+_Static_assert(KALMAN_BATCH_SINGULAR_MATRIX_ERROR == MAT_INV_SINGULAR_MATRIX_ERROR, "batch error codes differ");
+_Static_assert(KALMAN_BATCH_INVALID_ARGUMENT_ERROR > MAT_INV_SHAPE_MISMATCH_ERROR, "batch error codes overlap");
+
+// set by kalman_batch_reset, until then the global filter is all zeros
+static int batch_initialized = 0;
+
+int32_t kalman_batch_api_version(void)
+{
+    return KALMAN_BATCH_API_VERSION;
+}
+
+void kalman_batch_reset(const kalman_batch_tuning_t *tuning)
+{
+    kalman_default_tuning(&kalman_tuning);
+    if (tuning != NULL)
+    {
+        kalman_tuning.q_gain = tuning->q_gain;
+        kalman_tuning.r_gain = tuning->r_gain;
+        kalman_tuning.accel_variance = tuning->accel_variance;
+        kalman_tuning.gnss_x_variance = tuning->gnss_x_variance;
+        kalman_tuning.gnss_y_variance = tuning->gnss_y_variance;
+    }
+    kalman_filter_init();
+    batch_initialized = 1;
+}
+
+int32_t kalman_process_batch(int32_t num_samples, const float *accelerations, const float *measurements,
+                             const float *pressures, float *states_out, float *P_diag_out,
+                             int32_t *errorcode)
+{
+    if (errorcode == NULL)
+        return -1;
+    if (num_samples < 0 || accelerations == NULL || measurements == NULL || pressures == NULL ||
+        states_out == NULL)
+    {
+        *errorcode = KALMAN_BATCH_INVALID_ARGUMENT_ERROR;
+        return -1;
+    }
+    if (!batch_initialized)
+        kalman_batch_reset(NULL);
+
+    for (int32_t k = 0; k < num_samples; k++)
+    {
+        int step_error = 0;
+        if (!kalman_step(&filter_state, &kalman_tuning, &accelerations[k * numColB],
+                         &measurements[k * numRowH], pressures[k], &step_error))
+        {
+            *errorcode = step_error;
+            return k;
+        }
+
+        float *x_out = &states_out[k * dimState];
+        for (int i = 0; i < dimState; i++)
+            x_out[i] = (float)filter_state.x[i];
+        if (P_diag_out != NULL)
+        {
+            float *P_out = &P_diag_out[k * dimState];
+            for (int i = 0; i < dimState; i++)
+                P_out[i] = (float)filter_state.P[i * dimState + i];
+        }
+    }
+    return num_samples;
+}
@@ -0,0 +1,87 @@
+#ifndef KALMAN_BATCH_H
+#define KALMAN_BATCH_H
+
+#include <stdint.h>
+
+/*
+ * Stable C ABI of libkalman.so for host applications calling the filter
+ * through FFI. The header is self-contained: it uses only float and the
+ * fixed-width integer types, so an FFI binding can be written from it alone.
+ *
+ * kalman_process_batch runs the filter over a whole array of samples
+ * in one call. It reads the caller's arrays in place and writes the estimates
+ * straight into the caller's output arrays, so there is no copying and no
+ * vector_t wrapper per sample. Every array is contiguous and row-major with
+ * one row per sample.
+ *
+ * The library runs the single global filter of kalman_filter.c, so it is not
+ * reentrant: there is one filter per process, and calls from several threads
+ * must be serialized by the caller.
+ *
+ * Only functions marked KALMAN_API are exported from the shared library.
+ * KALMAN_BATCH_API_VERSION changes whenever a signature or an array
+ * layout changes.
+ */
+
+#define KALMAN_BATCH_API_VERSION 2
+
+// array widths, the same as dimState, numRowH and numColB of the filter
+#define KALMAN_BATCH_STATE_DIM 6
+#define KALMAN_BATCH_MEASUREMENT_DIM 3
+#define KALMAN_BATCH_CONTROL_DIM 3
+
+// errorcode values, the filter's own codes from math_util.h and the batch API's
+#define KALMAN_BATCH_DIMENSION_ERROR 1
+#define KALMAN_BATCH_SINGULAR_MATRIX_ERROR 3
+#define KALMAN_BATCH_INVALID_ARGUMENT_ERROR 5
+
+#if defined(__GNUC__)
+#define KALMAN_API __attribute__((visibility("default")))
+#else
+#define KALMAN_API
+#endif
+
+// the runtime tuning of the filter, field for field kalman_tuning_t
+typedef struct kalman_batch_tuning
+{
+    float q_gain;          // scales the process noise Q
+    float r_gain;          // scales the measurement noise R
+    float accel_variance;  // accelerometer variance, (m/s^2)^2
+    float gnss_x_variance; // m^2
+    float gnss_y_variance; // m^2
+} kalman_batch_tuning_t;
+
+/** KALMAN_BATCH_API_VERSION of the library, compare with the header */
+KALMAN_API int32_t kalman_batch_api_version(void);
+
+/**
+ * Reset the filter to its initial state with the given tuning,
+ * or the defaults when tuning is NULL. Call it before the first batch to
+ * choose the tuning and whenever a new, unrelated sample stream starts.
+ */
+KALMAN_API void kalman_batch_reset(const kalman_batch_tuning_t *tuning);
+
+/**
+ * Run one filter iteration per sample, continuing from the state the
+ * previous batch left. If kalman_batch_reset was never called, the first
+ * call resets the filter with the default tuning.
+ *
+ *   accelerations  num_samples x KALMAN_BATCH_CONTROL_DIM, earth frame, m/s^2
+ *   measurements   num_samples x KALMAN_BATCH_MEASUREMENT_DIM, GNSS x, y and
+ *                  barometer altitude, m
+ *   pressures      num_samples, Pa
+ *   states_out     num_samples x KALMAN_BATCH_STATE_DIM, xkk after each sample
+ *   P_diag_out     num_samples x KALMAN_BATCH_STATE_DIM diagonal of P after
+ *                  each sample, may be NULL
+ *
+ * Returns the number of samples processed. If that is less than num_samples
+ * errorcode holds the reason and the outputs of later samples are untouched.
+ * A negative num_samples or a NULL array other than P_diag_out is rejected
+ * with -1 and KALMAN_BATCH_INVALID_ARGUMENT_ERROR, without touching the
+ * filter; errorcode itself must not be NULL.
+ */
+KALMAN_API int32_t kalman_process_batch(int32_t num_samples, const float *accelerations, const float *measurements,
+                                        const float *pressures, float *states_out, float *P_diag_out,
+                                        int32_t *errorcode);
+
+#endif
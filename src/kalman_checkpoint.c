@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kalman_checkpoint.h"
+
+// padding bytes would be uninitialized yet covered by the checksum
+_Static_assert(offsetof(kalman_checkpoint_t, timestamp) == 2 * sizeof(uint32_t) &&
+                   offsetof(kalman_checkpoint_t, x) == offsetof(kalman_checkpoint_t, timestamp) + sizeof(double) &&
+                   offsetof(kalman_checkpoint_t, P) == offsetof(kalman_checkpoint_t, x) + dimState * sizeof(double) &&
+                   offsetof(kalman_checkpoint_t, tuning) ==
+                       offsetof(kalman_checkpoint_t, P) + dimState * dimState * sizeof(double) &&
+                   offsetof(kalman_checkpoint_t, checksum) ==
+                       offsetof(kalman_checkpoint_t, tuning) + sizeof(kalman_tuning_t),
+               "kalman_checkpoint_t must not have interior padding");
+_Static_assert(offsetof(kalman_checkpoint_t, checksum) + sizeof(uint32_t) == sizeof(kalman_checkpoint_t),
+               "kalman_checkpoint_t must not have trailing padding");
+
+// CRC-32 (IEEE 802.3), bitwise since a checkpoint is only a few hundred bytes
+static uint32_t crc32(const unsigned char *bytes, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+void kalman_checkpoint_encode(kalman_checkpoint_t *checkpoint, const kf6_t *kf,
+                              const kalman_tuning_t *tuning, double timestamp)
+{
+    checkpoint->magic = KALMAN_CHECKPOINT_MAGIC;
+    checkpoint->version = KALMAN_CHECKPOINT_VERSION;
+    checkpoint->dim_state = dimState;
+    checkpoint->timestamp = timestamp;
+    checkpoint->tuning = *tuning;
+    for (int i = 0; i < dimState; i++)
+        checkpoint->x[i] = (double)kf->x[i];
+    for (int i = 0; i < dimState * dimState; i++)
+        checkpoint->P[i] = (double)kf->P[i];
+    checkpoint->checksum = crc32((const unsigned char *)checkpoint, offsetof(kalman_checkpoint_t, checksum));
+}
+
+int kalman_checkpoint_decode(const kalman_checkpoint_t *checkpoint, kf6_t *kf,
+                             kalman_tuning_t *tuning, double *timestamp)
+{
+    if (checkpoint->magic != KALMAN_CHECKPOINT_MAGIC)
+    {
+        fprintf(stderr, "checkpoint: not a filter checkpoint or wrong byte order\n");
+        return 0;
+    }
+    if (checkpoint->version != KALMAN_CHECKPOINT_VERSION || checkpoint->dim_state != dimState)
+    {
+        fprintf(stderr, "checkpoint: version %d with %d states, expected version %d with %d states\n",
+                checkpoint->version, checkpoint->dim_state, KALMAN_CHECKPOINT_VERSION, dimState);
+        return 0;
+    }
+    if (checkpoint->checksum != crc32((const unsigned char *)checkpoint, offsetof(kalman_checkpoint_t, checksum)))
+    {
+        fprintf(stderr, "checkpoint: checksum mismatch\n");
+        return 0;
+    }
+
+    *tuning = checkpoint->tuning;
+    *timestamp = checkpoint->timestamp;
+    kalman_model_init(kf, tuning);
+    for (int i = 0; i < dimState; i++)
+        kf->x[i] = (real_t)checkpoint->x[i];
+    for (int i = 0; i < dimState * dimState; i++)
+        kf->P[i] = (real_t)checkpoint->P[i];
+    return 1;
+}
+
+// fsync the directory holding path, which makes a rename in it durable
+static int sync_directory(const char *path)
+{
+    char dir[4096];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else if (slash == path)
+        strcpy(dir, "/");
+    else
+    {
+        size_t length = (size_t)(slash - path);
+        if (length >= sizeof(dir))
+            length = sizeof(dir) - 1;
+        memcpy(dir, path, length);
+        dir[length] = '\0';
+    }
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+    {
+        perror("checkpoint: open directory");
+        return 0;
+    }
+    if (fsync(fd) != 0)
+    {
+        perror("checkpoint: fsync directory");
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+int kalman_checkpoint_save(const char *path, const kf6_t *kf, const kalman_tuning_t *tuning,
+                           double timestamp)
+{
+    kalman_checkpoint_t checkpoint;
+    char tmp_path[4096];
+
+    kalman_checkpoint_encode(&checkpoint, kf, tuning, timestamp);
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path))
+    {
+        fprintf(stderr, "checkpoint: path too long: %s\n", path);
+        return 0;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("checkpoint: open");
+        return 0;
+    }
+
+    // report each error before close or unlink can overwrite errno; fsync
+    // so the rename never points path at data that is not on disk yet
+    ssize_t written = write(fd, &checkpoint, sizeof(checkpoint));
+    if (written != (ssize_t)sizeof(checkpoint))
+    {
+        if (written < 0)
+            perror("checkpoint: write");
+        else
+            fprintf(stderr, "checkpoint: short write to %s\n", tmp_path);
+        close(fd);
+        unlink(tmp_path);
+        return 0;
+    }
+    if (fsync(fd) != 0)
+    {
+        perror("checkpoint: fsync");
+        close(fd);
+        unlink(tmp_path);
+        return 0;
+    }
+    if (close(fd) != 0)
+    {
+        perror("checkpoint: close");
+        unlink(tmp_path);
+        return 0;
+    }
+    if (rename(tmp_path, path) != 0)
+    {
+        perror("checkpoint: rename");
+        unlink(tmp_path);
+        return 0;
+    }
+    return sync_directory(path);
+}
+
+int kalman_checkpoint_restore(const char *path, kf6_t *kf, kalman_tuning_t *tuning, double *timestamp)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("checkpoint: open");
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size != (off_t)sizeof(kalman_checkpoint_t))
+    {
+        fprintf(stderr, "checkpoint: %s has the wrong size\n", path);
+        close(fd);
+        return 0;
+    }
+
+    void *mapped = mmap(NULL, sizeof(kalman_checkpoint_t), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        perror("checkpoint: mmap");
+        return 0;
+    }
+
+    int ok = kalman_checkpoint_decode(mapped, kf, tuning, timestamp);
+    munmap(mapped, sizeof(kalman_checkpoint_t));
+    return ok;
+}
@@ -0,0 +1,60 @@
+#ifndef KALMAN_CHECKPOINT_H
+#define KALMAN_CHECKPOINT_H
+
+#include <stdint.h>
+#include "kalman_filter.h"
+
+/*
+ * Warm-start checkpoints of a converged filter.
+ *
+ * A checkpoint is one fixed-size record holding the state, covariance,
+ * tuning and timestamp, stored in native byte order. The state and
+ * covariance are stored as double, so neither the float nor the double
+ * build loses precision and both read the same files. A checkpoint file is
+ * that record verbatim, so restoring maps the file and validates it in
+ * place. kalman_checkpoint_encode/decode work on memory only, for targets
+ * that keep the record in flash or EEPROM instead of a file.
+ */
+
+#define KALMAN_CHECKPOINT_MAGIC 0x5043464bu // "KFCP" in little endian
+#define KALMAN_CHECKPOINT_VERSION 2
+
+typedef struct kalman_checkpoint
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t dim_state;
+    double timestamp;
+    double x[dimState];
+    double P[dimState * dimState];
+    kalman_tuning_t tuning;
+    uint32_t checksum; // CRC-32 of every byte before this field
+} kalman_checkpoint_t;
+
+void kalman_checkpoint_encode(kalman_checkpoint_t *checkpoint, const kf6_t *kf,
+                              const kalman_tuning_t *tuning, double timestamp);
+
+/**
+ * Validate checkpoint and rebuild kf from it: the model from the stored
+ * tuning, then the stored state and covariance.
+ * Returns 0 if the magic, version, dimension or checksum do not match.
+ */
+int kalman_checkpoint_decode(const kalman_checkpoint_t *checkpoint, kf6_t *kf,
+                             kalman_tuning_t *tuning, double *timestamp);
+
+/**
+ * Write a checkpoint to path. The record goes to a temporary file that is
+ * synced and then renamed over path, and the directory is synced after the
+ * rename, so a crash or power loss never leaves a half written checkpoint.
+ * Returns 1 on success.
+ */
+int kalman_checkpoint_save(const char *path, const kf6_t *kf, const kalman_tuning_t *tuning,
+                           double timestamp);
+
+/**
+ * Memory-map the checkpoint at path and decode it into kf, tuning and
+ * timestamp. Returns 1 on success.
+ */
+int kalman_checkpoint_restore(const char *path, kf6_t *kf, kalman_tuning_t *tuning, double *timestamp);
+
+#endif
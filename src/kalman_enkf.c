@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "kalman_enkf.h"
+#include "sensor_handlers.h"
+
+#define NX dimState
+#define NU numColB
+#define NZ numRowH
+#define C ENKF_CHUNK
+#define G (ENKF_GROUP_CHUNKS * ENKF_CHUNK) // members per group
+
+// barrier on a condition variable; parties can be lowered before first use
+typedef struct enkf_barrier
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int parties;
+    int waiting;
+    unsigned generation;
+} enkf_barrier_t;
+
+// sums over the members of one group, relative to the reference point of the
+// step, kept per lane of a chunk. The prediction fills h to x, the update x
+// to xx
+typedef struct enkf_sums
+{
+    real_t h[NZ][C];
+    real_t xh[NX * NZ][C];
+    real_t hh[NZ * NZ][C];
+    real_t x[NX][C];
+    real_t xx[NX * NX][C];
+} enkf_sums_t;
+
+// the same sums over the whole ensemble
+typedef struct enkf_totals
+{
+    real_t x[NX];
+    real_t h[NZ];
+    real_t xh[NX * NZ];
+    real_t hh[NZ * NZ];
+    real_t xx[NX * NX];
+} enkf_totals_t;
+
+typedef struct enkf_worker
+{
+    enkf_t *enkf;
+    int begin, end; // members handled by this thread
+    pthread_t thread;
+} enkf_worker_t;
+
+struct enkf_shared
+{
+    enkf_barrier_t barrier;
+    int stop;
+    int failed;
+    real_t *h; // NZ rows of num_members predicted measurements
+    // sums of every group of ENKF_GROUP_CHUNKS chunks, reduced in group
+    // order so the result does not depend on how the groups are split
+    // across threads
+    enkf_sums_t *group_sums;
+
+    // inputs of the current step
+    real_t u[NU];
+    real_t z[NZ];
+    real_t sigma_w;     // standard deviation of the acceleration noise
+    real_t sigma_v[NZ]; // standard deviations of the observation noise
+    real_t x_ref[NX];   // predicted mean, the reference point of the sums
+    real_t h_ref[NZ];
+    real_t K[NX * NZ];
+
+    enkf_worker_t workers[];
+};
+
+static void barrier_wait(enkf_barrier_t *b)
+{
+    pthread_mutex_lock(&b->lock);
+    unsigned generation = b->generation;
+    if (++b->waiting == b->parties)
+    {
+        b->waiting = 0;
+        b->generation++;
+        pthread_cond_broadcast(&b->cond);
+    }
+    else
+    {
+        while (generation == b->generation)
+            pthread_cond_wait(&b->cond, &b->lock);
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+/**
+ * Unit variance deviates for one chunk of members from the sum of four
+ * uniforms (Irwin-Hall). Unlike Box-Muller this needs no log or cos, so it
+ * vectorizes across the chunk. The tails are cut at 3.46 sigma.
+ */
+static void chunk_normal(uint32_t *restrict rng, float *restrict out)
+{
+    for (int c = 0; c < C; c++)
+    {
+        uint32_t s = rng[c];
+        float sum = 0.0f;
+        for (int k = 0; k < 4; k++)
+        {
+            // xorshift32
+            s ^= s << 13;
+            s ^= s >> 17;
+            s ^= s << 5;
+            sum += (float)(int32_t)(s >> 8);
+        }
+        rng[c] = s;
+        out[c] = (sum * (1.0f / 16777216.0f) - 2.0f) * 1.7320508f;
+    }
+}
+
+// GNSS measures x and y, the barometer the pressure at altitude z
+static void measure(const real_t *x, real_t *h)
+{
+    h[0] = x[0];
+    h[1] = x[1];
+    h[2] = pressure_at_altitude((float)x[2]);
+}
+
+static void predict_block(enkf_worker_t *worker)
+{
+    enkf_t *enkf = worker->enkf;
+    struct enkf_shared *sh = enkf->shared;
+    const real_t *Fm = enkf->model.F, *Bm = enkf->model.B;
+    int n = enkf->num_members;
+    // per lane sums, stored at the end of every group
+    real_t acc_x[NX][C] = {{0}}, acc_h[NZ][C] = {{0}};
+    real_t acc_xh[NX * NZ][C] = {{0}}, acc_hh[NZ * NZ][C] = {{0}};
+
+    for (int m0 = worker->begin; m0 < worker->end; m0 += C)
+    {
+        real_t xc[NX][C], xn[NX][C], dx[NX][C], dh[NZ][C];
+        float w[NU][C];
+
+        for (int e = 0; e < NX; e++)
+            memcpy(xc[e], &enkf->x[e * n + m0], sizeof(xc[e]));
+        for (int j = 0; j < NU; j++)
+            chunk_normal(&enkf->rng[m0], w[j]);
+
+        // x = F * x + B * (u + w)
+        for (int e = 0; e < NX; e++)
+        {
+            for (int c = 0; c < C; c++)
+                xn[e][c] = 0.0f;
+            for (int k = 0; k < NX; k++)
+                for (int c = 0; c < C; c++)
+                    xn[e][c] += Fm[e * NX + k] * xc[k][c];
+            for (int j = 0; j < NU; j++)
+                for (int c = 0; c < C; c++)
+                    xn[e][c] += Bm[e * NU + j] * (sh->u[j] + sh->sigma_w * w[j][c]);
+        }
+
+        for (int c = 0; c < C; c++)
+        {
+            real_t xm[NX], hm[NZ];
+            for (int e = 0; e < NX; e++)
+                xm[e] = xn[e][c];
+            measure(xm, hm);
+            for (int k = 0; k < NZ; k++)
+            {
+                sh->h[k * n + m0 + c] = hm[k];
+                dh[k][c] = hm[k] - sh->h_ref[k];
+            }
+        }
+
+        for (int e = 0; e < NX; e++)
+        {
+            memcpy(&enkf->x[e * n + m0], xn[e], sizeof(xn[e]));
+            for (int c = 0; c < C; c++)
+            {
+                dx[e][c] = xn[e][c] - sh->x_ref[e];
+                acc_x[e][c] += dx[e][c];
+            }
+        }
+        for (int k = 0; k < NZ; k++)
+        {
+            for (int c = 0; c < C; c++)
+                acc_h[k][c] += dh[k][c];
+            for (int e = 0; e < NX; e++)
+                for (int c = 0; c < C; c++)
+                    acc_xh[e * NZ + k][c] += dx[e][c] * dh[k][c];
+            for (int l = 0; l < NZ; l++)
+                for (int c = 0; c < C; c++)
+                    acc_hh[k * NZ + l][c] += dh[k][c] * dh[l][c];
+        }
+
+        if ((m0 + C) % G != 0 && m0 + C != worker->end)
+            continue;
+        enkf_sums_t *sums = &sh->group_sums[m0 / G];
+        memcpy(sums->x, acc_x, sizeof(acc_x));
+        memcpy(sums->h, acc_h, sizeof(acc_h));
+        memcpy(sums->xh, acc_xh, sizeof(acc_xh));
+        memcpy(sums->hh, acc_hh, sizeof(acc_hh));
+        memset(acc_x, 0, sizeof(acc_x));
+        memset(acc_h, 0, sizeof(acc_h));
+        memset(acc_xh, 0, sizeof(acc_xh));
+        memset(acc_hh, 0, sizeof(acc_hh));
+    }
+}
+
+static void update_block(enkf_worker_t *worker)
+{
+    enkf_t *enkf = worker->enkf;
+    struct enkf_shared *sh = enkf->shared;
+    int n = enkf->num_members;
+    real_t acc_x[NX][C] = {{0}}, acc_xx[NX * NX][C] = {{0}};
+
+    for (int m0 = worker->begin; m0 < worker->end; m0 += C)
+    {
+        real_t xc[NX][C], d[NZ][C], dx[NX][C];
+        float v[NZ][C];
+
+        // innovation against perturbed observations
+        for (int k = 0; k < NZ; k++)
+        {
+            chunk_normal(&enkf->rng[m0], v[k]);
+            for (int c = 0; c < C; c++)
+                d[k][c] = sh->z[k] + sh->sigma_v[k] * v[k][c] - sh->h[k * n + m0 + c];
+        }
+
+        for (int e = 0; e < NX; e++)
+        {
+            memcpy(xc[e], &enkf->x[e * n + m0], sizeof(xc[e]));
+            for (int k = 0; k < NZ; k++)
+                for (int c = 0; c < C; c++)
+                    xc[e][c] += sh->K[e * NZ + k] * d[k][c];
+            memcpy(&enkf->x[e * n + m0], xc[e], sizeof(xc[e]));
+            for (int c = 0; c < C; c++)
+            {
+                dx[e][c] = xc[e][c] - sh->x_ref[e];
+                acc_x[e][c] += dx[e][c];
+            }
+        }
+        for (int e = 0; e < NX; e++)
+            for (int k = 0; k < NX; k++)
+                for (int c = 0; c < C; c++)
+                    acc_xx[e * NX + k][c] += dx[e][c] * dx[k][c];
+
+        if ((m0 + C) % G != 0 && m0 + C != worker->end)
+            continue;
+        enkf_sums_t *sums = &sh->group_sums[m0 / G];
+        memcpy(sums->x, acc_x, sizeof(acc_x));
+        memcpy(sums->xx, acc_xx, sizeof(acc_xx));
+        memset(acc_x, 0, sizeof(acc_x));
+        memset(acc_xx, 0, sizeof(acc_xx));
+    }
+}
+
+/**
+ * add the group sums in group order, lane by lane, then the lanes. Only the
+ * fields from byte offset begin to end of enkf_sums_t are summed, the
+ * struct is all real_t so they are added as one array.
+ */
+static void combine_sums(const enkf_t *enkf, enkf_totals_t *total, size_t begin, size_t end)
+{
+    enkf_sums_t lanes;
+    real_t *sum = (real_t *)((char *)&lanes + begin);
+    size_t count = (end - begin) / sizeof(real_t);
+
+    memset(&lanes, 0, sizeof(lanes));
+    for (int group = 0; group < (enkf->num_members + G - 1) / G; group++)
+    {
+        const real_t *s = (const real_t *)((const char *)&enkf->shared->group_sums[group] + begin);
+        for (size_t i = 0; i < count; i++)
+            sum[i] += s[i];
+    }
+
+    memset(total, 0, sizeof(*total));
+    for (int e = 0; e < NX; e++)
+        for (int c = 0; c < C; c++)
+            total->x[e] += lanes.x[e][c];
+    for (int k = 0; k < NZ; k++)
+        for (int c = 0; c < C; c++)
+            total->h[k] += lanes.h[k][c];
+    for (int i = 0; i < NX * NZ; i++)
+        for (int c = 0; c < C; c++)
+            total->xh[i] += lanes.xh[i][c];
+    for (int i = 0; i < NZ * NZ; i++)
+        for (int c = 0; c < C; c++)
+            total->hh[i] += lanes.hh[i][c];
+    for (int i = 0; i < NX * NX; i++)
+        for (int c = 0; c < C; c++)
+            total->xx[i] += lanes.xx[i][c];
+}
+
+// K = Pxh * inv(Phh + R) from the sample covariances of the predicted ensemble
+static int compute_gain(enkf_t *enkf, int *errorcode)
+{
+    struct enkf_shared *sh = enkf->shared;
+    enkf_totals_t total;
+    real_t n = (real_t)enkf->num_members;
+    real_t mx[NX], mh[NZ], Pxh[NX * NZ], Phh[NZ * NZ], invPhh[NZ * NZ];
+
+    combine_sums(enkf, &total, offsetof(enkf_sums_t, h), offsetof(enkf_sums_t, xx));
+    for (int e = 0; e < NX; e++)
+        mx[e] = total.x[e] / n;
+    for (int k = 0; k < NZ; k++)
+        mh[k] = total.h[k] / n;
+    for (int e = 0; e < NX; e++)
+        for (int k = 0; k < NZ; k++)
+            Pxh[e * NZ + k] = (total.xh[e * NZ + k] - n * mx[e] * mh[k]) / (n - 1.0f);
+    for (int k = 0; k < NZ; k++)
+    {
+        for (int l = 0; l < NZ; l++)
+            Phh[k * NZ + l] = (total.hh[k * NZ + l] - n * mh[k] * mh[l]) / (n - 1.0f);
+        Phh[k * NZ + k] += sh->sigma_v[k] * sh->sigma_v[k];
+    }
+
+    if (!kalman_invert(Phh, invPhh, NZ, errorcode))
+        return 0;
+    kalman_gemm(Pxh, invPhh, sh->K, NX, NZ, NZ);
+    return 1;
+}
+
+static void compute_moments(enkf_t *enkf)
+{
+    enkf_totals_t total;
+    real_t n = (real_t)enkf->num_members, mx[NX];
+
+    combine_sums(enkf, &total, offsetof(enkf_sums_t, x), sizeof(enkf_sums_t));
+    for (int e = 0; e < NX; e++)
+    {
+        mx[e] = total.x[e] / n;
+        enkf->x_mean[e] = enkf->shared->x_ref[e] + mx[e];
+    }
+    for (int e = 0; e < NX; e++)
+        for (int k = 0; k < NX; k++)
+            enkf->P[e * NX + k] = (total.xx[e * NX + k] - n * mx[e] * mx[k]) / (n - 1.0f);
+}
+
+static void *worker_main(void *arg)
+{
+    enkf_worker_t *worker = arg;
+    struct enkf_shared *sh = worker->enkf->shared;
+    for (;;)
+    {
+        barrier_wait(&sh->barrier);
+        if (sh->stop)
+            return NULL;
+        predict_block(worker);
+        barrier_wait(&sh->barrier);
+        barrier_wait(&sh->barrier); // gain computed by the first thread
+        if (!sh->failed)
+            update_block(worker);
+        barrier_wait(&sh->barrier);
+    }
+}
+
+int enkf_init(enkf_t *enkf, const kalman_tuning_t *tuning, int num_members, int num_threads, unsigned long seed)
+{
+    // enkf_free must find nothing to free if the init fails
+    enkf->x = NULL;
+    enkf->rng = NULL;
+    enkf->shared = NULL;
+    if (num_members < 2)
+    {
+        fprintf(stderr, "enkf: at least 2 members needed\n");
+        return 0;
+    }
+    if (num_threads < 1)
+        num_threads = 1;
+    int n = (num_members + C - 1) / C * C;
+
+    enkf->num_members = n;
+    enkf->num_threads = num_threads;
+    enkf->tuning = *tuning;
+    kalman_model_init(&enkf->model, tuning);
+    enkf->x = malloc((size_t)n * NX * sizeof(real_t));
+    enkf->rng = malloc((size_t)n * sizeof(uint32_t));
+    enkf->shared = calloc(1, sizeof(struct enkf_shared) + (size_t)num_threads * sizeof(enkf_worker_t));
+    real_t *h = malloc((size_t)n * NZ * sizeof(real_t));
+    enkf_sums_t *group_sums = malloc((size_t)((n + G - 1) / G) * sizeof(enkf_sums_t));
+    if (enkf->x == NULL || enkf->rng == NULL || enkf->shared == NULL || h == NULL || group_sums == NULL)
+    {
+        fprintf(stderr, "enkf: out of memory\n");
+        free(enkf->x);
+        free(enkf->rng);
+        free(enkf->shared);
+        free(h);
+        free(group_sums);
+        enkf->x = NULL;
+        enkf->rng = NULL;
+        enkf->shared = NULL;
+        return 0;
+    }
+    struct enkf_shared *sh = enkf->shared;
+    sh->h = h;
+    sh->group_sums = group_sums;
+
+    // one generator per member, seeded by splitmix64
+    unsigned long long state = seed;
+    for (int m = 0; m < n; m++)
+    {
+        unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        enkf->rng[m] = (uint32_t)(z >> 32) | 1u;
+    }
+
+    // initial ensemble around the state and covariance diagonal of the model
+    for (int m0 = 0; m0 < n; m0 += C)
+        for (int e = 0; e < NX; e++)
+        {
+            float w[C];
+            chunk_normal(&enkf->rng[m0], w);
+            for (int c = 0; c < C; c++)
+                enkf->x[e * n + m0 + c] = enkf->model.x[e] + sqrtf((float)enkf->model.P[e * NX + e]) * w[c];
+        }
+    memcpy(enkf->x_mean, enkf->model.x, sizeof(enkf->x_mean));
+    memcpy(enkf->P, enkf->model.P, sizeof(enkf->P));
+
+    pthread_mutex_init(&sh->barrier.lock, NULL);
+    pthread_cond_init(&sh->barrier.cond, NULL);
+    sh->barrier.parties = num_threads;
+    for (int t = 0; t < num_threads; t++)
+        sh->workers[t].enkf = enkf;
+    for (int t = 1; t < num_threads; t++)
+    {
+        if (pthread_create(&sh->workers[t].thread, NULL, worker_main, &sh->workers[t]) != 0)
+        {
+            // continue with the threads that did start
+            pthread_mutex_lock(&sh->barrier.lock);
+            sh->barrier.parties = t;
+            pthread_mutex_unlock(&sh->barrier.lock);
+            enkf->num_threads = t;
+            break;
+        }
+    }
+
+    // split the ensemble into whole groups per thread, read by the workers
+    // only after the first barrier
+    int groups = (n + G - 1) / G;
+    for (int t = 0; t < enkf->num_threads; t++)
+    {
+        int begin = groups * t / enkf->num_threads * G, end = groups * (t + 1) / enkf->num_threads * G;
+        sh->workers[t].begin = begin < n ? begin : n;
+        sh->workers[t].end = end < n ? end : n;
+    }
+    return 1;
+}
+
+void enkf_free(enkf_t *enkf)
+{
+    struct enkf_shared *sh = enkf->shared;
+    if (sh == NULL)
+        return;
+    sh->stop = 1;
+    barrier_wait(&sh->barrier);
+    for (int t = 1; t < enkf->num_threads; t++)
+        pthread_join(sh->workers[t].thread, NULL);
+    pthread_mutex_destroy(&sh->barrier.lock);
+    pthread_cond_destroy(&sh->barrier.cond);
+    free(sh->h);
+    free(sh->group_sums);
+    free(sh);
+    free(enkf->x);
+    free(enkf->rng);
+    enkf->x = NULL;
+    enkf->rng = NULL;
+    enkf->shared = NULL;
+}
+
+int enkf_step(enkf_t *enkf, const float *ak, const float *zk, float pressure, int *errorcode)
+{
+    struct enkf_shared *sh = enkf->shared;
+    real_t Bu[NX];
+
+    for (int j = 0; j < NU; j++)
+        sh->u[j] = ak[j];
+    sh->z[0] = zk[0];
+    sh->z[1] = zk[1];
+    sh->z[2] = pressure;
+    sh->sigma_w = sqrtf(enkf->tuning.accel_variance * enkf->tuning.q_gain);
+    sh->sigma_v[0] = sqrtf(enkf->tuning.gnss_x_variance * enkf->tuning.r_gain);
+    sh->sigma_v[1] = sqrtf(enkf->tuning.gnss_y_variance * enkf->tuning.r_gain);
+    sh->sigma_v[2] = sqrtf(barometer_variance * enkf->tuning.r_gain);
+    sh->failed = 0;
+
+    // the predicted mean of the last estimate keeps the sums small
+    kalman_gemm(enkf->model.F, enkf->x_mean, sh->x_ref, NX, NX, 1);
+    kalman_gemm(enkf->model.B, sh->u, Bu, NX, NU, 1);
+    kalman_add(sh->x_ref, Bu, sh->x_ref, NX);
+    measure(sh->x_ref, sh->h_ref);
+
+    barrier_wait(&sh->barrier);
+    predict_block(&sh->workers[0]);
+    barrier_wait(&sh->barrier);
+    if (!compute_gain(enkf, errorcode))
+        sh->failed = 1;
+    barrier_wait(&sh->barrier);
+    if (!sh->failed)
+        update_block(&sh->workers[0]);
+    barrier_wait(&sh->barrier);
+
+    if (sh->failed)
+        return 0;
+    compute_moments(enkf);
+    return 1;
+}
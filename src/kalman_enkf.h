@@ -0,0 +1,82 @@
+#ifndef KALMAN_ENKF_H
+#define KALMAN_ENKF_H
+
+#include <stdint.h>
+#include "kalman_filter.h"
+
+/*
+ * Ensemble Kalman filter on the kf6 motion model that measures the raw
+ * barometer pressure through the nonlinear barometric formula
+ * (pressure_at_altitude) instead of the linearized altitude of kalman_step.
+ *
+ * Every member is propagated through F and B with its own draw of the
+ * acceleration noise (Q = B * B.T * accel_variance * q_gain for this model)
+ * and updated against perturbed GNSS x, y and pressure observations. The
+ * gain comes from the sample covariances of the ensemble.
+ *
+ * It is not a win on the simulated flights. Up to their apogee of about
+ * 700 m the barometric formula is close to linear, so the linearized
+ * altitude of kalman_step loses nothing, and the sampling noise of the
+ * ensemble costs accuracy. With 256 members the position RMSE is from 1 %
+ * better to 5 % worse, e.g. 0.934 m against 0.897 m, and a step on one
+ * thread takes 15 to 30 times a kalman_step.
+ *
+ * Members are stored state component by state component, x[e * num_members + m],
+ * and processed in chunks of ENKF_CHUNK so the loops over members vectorize.
+ * The ensemble is split into num_threads contiguous blocks of whole groups of
+ * ENKF_GROUP_CHUNKS chunks, one block per thread. The sample statistics are
+ * reduced from per-group partial sums in group order, so the same seed gives
+ * the same result for any number of threads.
+ */
+
+#ifndef ENKF_CHUNK
+#define ENKF_CHUNK 8
+#endif
+
+// chunks per partial sum. The threads split the ensemble in whole groups, so
+// threads past the number of groups stay idle. Smaller groups cost time in
+// the reduction, at 1 about 50 % more per step with 256 members
+#ifndef ENKF_GROUP_CHUNKS
+#define ENKF_GROUP_CHUNKS 8
+#endif
+
+struct enkf_shared;
+
+typedef struct enkf
+{
+    int num_members; // multiple of ENKF_CHUNK
+    int num_threads;
+    kf6_t model;
+    kalman_tuning_t tuning;
+    real_t *x;     // dimState rows of num_members
+    uint32_t *rng; // random generator state of every member
+
+    // ensemble mean and sample covariance after the last step
+    real_t x_mean[dimState];
+    real_t P[dimState * dimState];
+
+    struct enkf_shared *shared; // worker threads and partial sums
+} enkf_t;
+
+/**
+ * Draw num_members (rounded up to a multiple of ENKF_CHUNK) members around
+ * the initial state and covariance of kalman_model_init and start
+ * num_threads - 1 worker threads; the caller of enkf_step is the first.
+ * The same seed gives the same ensemble. Returns 0 on failure.
+ */
+int enkf_init(enkf_t *enkf, const kalman_tuning_t *tuning, int num_members, int num_threads, unsigned long seed);
+
+/**
+ * Stop the worker threads and free the ensemble. Does nothing after a failed
+ * enkf_init or a previous enkf_free.
+ */
+void enkf_free(enkf_t *enkf);
+
+/**
+ * One predict and update with accelerations ak, GNSS x and y in zk[0] and
+ * zk[1] and the raw pressure; zk[2] is not used. The result is in
+ * enkf->x_mean and enkf->P. Returns 1 on success.
+ */
+int enkf_step(enkf_t *enkf, const float *ak, const float *zk, float pressure, int *errorcode);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef KALMAN_FILTER_H
+#define KALMAN_FILTER_H
+
+#include "kalman_config.h"
+#include "kalman_generic.h"
+#include "math_util.h"
+
+// constant acceleration model: position and velocity in x, y, z,
+// GNSS x, y and barometer altitude as measurements, earth frame
+// accelerations as control input
+KALMAN_FILTER_DEFINE(kf6, dimState, numRowH, numColB)
+
+// filter parameters that can be changed at runtime,
+// kalman_default_tuning gives the values from kalman_config.h and sensor_handlers.h
+typedef struct kalman_tuning
+{
+    float q_gain;          // scales the process noise Q
+    float r_gain;          // scales the measurement noise R
+    float accel_variance;  // accelerometer variance, (m/s^2)^2
+    float gnss_x_variance; // m^2
+    float gnss_y_variance; // m^2
+} kalman_tuning_t;
+
+void kalman_default_tuning(kalman_tuning_t *tuning);
+
+/**
+ * Fill F, B, H, Q and R of kf for the constant acceleration model and reset
+ * the state to zero with P = Id
+ */
+void kalman_model_init(kf6_t *kf, const kalman_tuning_t *tuning);
+
+/**
+ * Set R of kf for the barometer variance at the given pressure
+ */
+void kalman_model_update_R(kf6_t *kf, const kalman_tuning_t *tuning, float pressure);
+
+/**
+ * One predict and update of kf with accelerations ak, GNSS/barometer
+ * measurements zk and the raw pressure. Returns 1 on success.
+ */
+int kalman_step(kf6_t *kf, const kalman_tuning_t *tuning, const float *ak, const float *zk,
+                float pressure, int *errorcode);
+
+// observation matrices of one GNSS receiver (x, y) and one barometer (altitude)
+extern const real_t gnss_H[2 * dimState];
+extern const real_t barometer_H[dimState];
+
+/**
+ * One predict of kf with accelerations ak followed by an information form
+ * update with every sensor in sensors, e.g. several GNSS receivers and
+ * barometers each with their own R. Returns 1 on success.
+ */
+int kalman_step_information(kf6_t *kf, const float *ak, const kalman_sensor_t *sensors,
+                            int num_sensors, int *errorcode);
+
+// the filter instance and tuning behind the functions below
+extern kf6_t filter_state;
+extern kalman_tuning_t kalman_tuning;
+
+// views of the model matrices stored in filter_state
+extern matrix_t Id, F, Ft, B, H, Ht, Q, R, P;
+extern vector_t yk, xkk;
+
+void kalman_filter_init(void);
+void kalman_set_tuning(const kalman_tuning_t *tuning);
+int getQgain(float *qgain);
+int predict(vector_t *predVec, matrix_t *predCov, vector_t *ak, int *errorcode);
+int update(vector_t *predVec, matrix_t *pred_cov_mat, vector_t *zk, float pressure, int *errorcode);
+int KF_one_iteration(vector_t *ak, vector_t *zk, float pressure, int *errorcode);
+
+#endif
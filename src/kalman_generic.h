@@ -0,0 +1,454 @@
+#ifndef KALMAN_GENERIC_H
+#define KALMAN_GENERIC_H
+
+#include <stdio.h>
+#include <math.h>
+#include "math_util.h"
+
+#ifdef MATH_UTIL_FIXED
+// the filter needs the dynamic range of floating point
+#error "MATH_UTIL_FIXED covers only the math_util kernels, build the filter with float or double"
+#endif
+
+/*
+ * Dimension-generic linear Kalman filter.
+ *
+ * KALMAN_FILTER_DEFINE(name, NX, NZ, NU) generates
+ *
+ *   name_t                 filter state and model matrices, all row-major
+ *                          real_t arrays sized exactly from NX, NZ and NU
+ *   name_init(kf)          zero the model, F = Id and P = Id
+ *   name_commit_model(kf)  refresh the cached transposes Ft and Ht, call
+ *                          after changing F or H
+ *   name_predict(...)      x_pred = F*x + B*u, P_pred = F*P*F.T + Q
+ *   name_update(...)       fold measurement z into kf->x and kf->P
+ *   name_iterate(...)      predict followed by update
+ *   name_update_information(...)
+ *                          fold any number of independent sensors into
+ *                          kf->x and kf->P in information form, with one
+ *                          NX x NX solve and no inverse of P
+ *
+ * All dimensions are compile time constants, so the kernels below are
+ * inlined with constant loop bounds and every temporary lives on the stack
+ * with its exact size. NX, NZ and NU must all be at least 1.
+ *
+ * Example: a 9 state model with 3 measurements and 3 control inputs
+ *
+ *   KALMAN_FILTER_DEFINE(kf9, 9, 3, 3)
+ *   kf9_t kf;
+ *   kf9_init(&kf);
+ *   ... fill kf.F, kf.B, kf.H, kf.Q, kf.R ...
+ *   kf9_commit_model(&kf);
+ *   kf9_iterate(&kf, ak, zk, &errorcode);
+ */
+
+// widest cols for which kalman_gemm takes a dot product per element
+#define KALMAN_GEMM_DOT_MAX_COLS 8
+
+/**
+ * c = a * b where a is rows x inner and b is inner x cols, c must not share
+ * storage with a or b. Up to KALMAN_GEMM_DOT_MAX_COLS columns, e.g. all of
+ * kf6, each element is a dot product summed in a register, which measured
+ * about 20 % faster per kf6 step. Wider, row, inner index, then col: each
+ * element of a is broadcast over a row of b and a row of c, both walked
+ * contiguously.
+ */
+static inline void kalman_gemm(const real_t *a, const real_t *b, real_t *c, int rows, int inner, int cols)
+{
+    if (cols <= KALMAN_GEMM_DOT_MAX_COLS)
+    {
+        for (int row = 0; row < rows; row++)
+        {
+            for (int col = 0; col < cols; col++)
+            {
+                real_t res = 0;
+                for (int i = 0; i < inner; i++)
+                    res += a[row * inner + i] * b[i * cols + col];
+                c[row * cols + col] = res;
+            }
+        }
+        return;
+    }
+    for (int row = 0; row < rows; row++)
+    {
+        real_t *c_row = &c[row * cols];
+        for (int col = 0; col < cols; col++)
+            c_row[col] = 0;
+        for (int i = 0; i < inner; i++)
+        {
+            real_t a_ri = a[row * inner + i];
+            const real_t *b_row = &b[i * cols];
+            for (int col = 0; col < cols; col++)
+                c_row[col] += a_ri * b_row[col];
+        }
+    }
+}
+
+/** out = a + b over n elements */
+static inline void kalman_add(const real_t *a, const real_t *b, real_t *out, int n)
+{
+    for (int i = 0; i < n; i++)
+        out[i] = a[i] + b[i];
+}
+
+/** out = a - b over n elements */
+static inline void kalman_sub(const real_t *a, const real_t *b, real_t *out, int n)
+{
+    for (int i = 0; i < n; i++)
+        out[i] = a[i] - b[i];
+}
+
+/** store the rows x cols matrix a transposed in at */
+static inline void kalman_transpose(const real_t *a, real_t *at, int rows, int cols)
+{
+    for (int row = 0; row < rows; row++)
+        for (int col = 0; col < cols; col++)
+            at[col * rows + row] = a[row * cols + col];
+}
+
+/**
+ * Solve a * out = b for out, written over b. a is n x n and is destroyed, b
+ * is n x cols. Gaussian elimination with partial pivoting; like matinv, a is
+ * singular if a pivot is below MAT_INV_RELATIVE_TOL times the largest element
+ * of its column in a.
+ */
+static inline int kalman_solve(real_t *a, real_t *b, int n, int cols, int *errorcode)
+{
+    real_t column_max[n];
+    for (int col = 0; col < n; col++)
+    {
+        column_max[col] = 0;
+        for (int row = 0; row < n; row++)
+        {
+            if (real_abs(a[row * n + col]) > column_max[col])
+                column_max[col] = real_abs(a[row * n + col]);
+        }
+    }
+
+    for (int col = 0; col < n; col++)
+    {
+        int pivot = col;
+        for (int row = col + 1; row < n; row++)
+        {
+            if (real_abs(a[row * n + col]) > real_abs(a[pivot * n + col]))
+                pivot = row;
+        }
+        real_t largest = real_abs(a[pivot * n + col]);
+        if (largest == 0 || (double)largest < MAT_INV_RELATIVE_TOL * (double)column_max[col])
+        {
+            fprintf(stderr, "Error: solving with a singular matrix!\n");
+            *errorcode = MAT_INV_SINGULAR_MATRIX_ERROR;
+            return 0;
+        }
+        if (pivot != col)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                real_t t = a[col * n + i];
+                a[col * n + i] = a[pivot * n + i];
+                a[pivot * n + i] = t;
+            }
+            for (int i = 0; i < cols; i++)
+            {
+                real_t t = b[col * cols + i];
+                b[col * cols + i] = b[pivot * cols + i];
+                b[pivot * cols + i] = t;
+            }
+        }
+
+        // eliminate below the pivot
+        for (int row = col + 1; row < n; row++)
+        {
+            real_t factor = a[row * n + col] / a[col * n + col];
+            for (int i = col + 1; i < n; i++)
+                a[row * n + i] -= factor * a[col * n + i];
+            for (int i = 0; i < cols; i++)
+                b[row * cols + i] -= factor * b[col * cols + i];
+        }
+    }
+
+    // back substitution
+    for (int row = n - 1; row >= 0; row--)
+    {
+        for (int k = row + 1; k < n; k++)
+        {
+            real_t a_rk = a[row * n + k];
+            for (int i = 0; i < cols; i++)
+                b[row * cols + i] -= a_rk * b[k * cols + i];
+        }
+        for (int i = 0; i < cols; i++)
+            b[row * cols + i] /= a[row * n + row];
+    }
+    return 1;
+}
+
+/**
+ * inv_a = inv(a) for a 3x3 a by its cofactors. a is singular under the test
+ * of inv3x3: |det(a)| below MAT_INV_RELATIVE_TOL times the product of its
+ * row norms.
+ */
+static inline int kalman_invert3(const real_t *a, real_t *inv_a, int *errorcode)
+{
+    real_t c00 = a[4] * a[8] - a[5] * a[7];
+    real_t c01 = a[5] * a[6] - a[3] * a[8];
+    real_t c02 = a[3] * a[7] - a[4] * a[6];
+    real_t det = a[0] * c00 + a[1] * c01 + a[2] * c02;
+
+    double row_norms = 1.0;
+    for (int row = 0; row < 3; row++)
+        row_norms *= fabs((double)a[row * 3]) + fabs((double)a[row * 3 + 1]) + fabs((double)a[row * 3 + 2]);
+    if (det == 0 || fabs((double)det) < MAT_INV_RELATIVE_TOL * row_norms)
+    {
+        fprintf(stderr, "Error: taking inverse of non-invertible matrix!");
+        *errorcode = MAT_INV_SINGULAR_MATRIX_ERROR;
+        return 0;
+    }
+
+    // the transposed cofactor matrix over det
+    real_t inv_det = 1 / det;
+    inv_a[0] = c00 * inv_det;
+    inv_a[1] = (a[2] * a[7] - a[1] * a[8]) * inv_det;
+    inv_a[2] = (a[1] * a[5] - a[2] * a[4]) * inv_det;
+    inv_a[3] = c01 * inv_det;
+    inv_a[4] = (a[0] * a[8] - a[2] * a[6]) * inv_det;
+    inv_a[5] = (a[2] * a[3] - a[0] * a[5]) * inv_det;
+    inv_a[6] = c02 * inv_det;
+    inv_a[7] = (a[1] * a[6] - a[0] * a[7]) * inv_det;
+    inv_a[8] = (a[0] * a[4] - a[1] * a[3]) * inv_det;
+    return 1;
+}
+
+/**
+ * invert the n x n matrix s into inv_s on the arrays themselves, by
+ * kalman_invert3 for 3x3 and by kalman_solve against Id otherwise.
+ * s is destroyed when n is not 3.
+ */
+static inline int kalman_invert(real_t *s, real_t *inv_s, int n, int *errorcode)
+{
+    if (n == 3)
+        return kalman_invert3(s, inv_s, errorcode);
+    for (int i = 0; i < n * n; i++)
+        inv_s[i] = 0;
+    for (int i = 0; i < n; i++)
+        inv_s[i * n + i] = 1;
+    return kalman_solve(s, inv_s, n, n, errorcode);
+}
+
+// largest dim of a kalman_sensor_t, bounds the stack arrays of kalman_information_add
+#define KALMAN_SENSOR_MAX_DIM 16
+
+/**
+ * One independent measurement source for the information form update:
+ * z = H * x + v with v ~ N(0, R). H is dim x NX, R is dim x dim, both row-major,
+ * and 1 <= dim <= KALMAN_SENSOR_MAX_DIM.
+ */
+typedef struct kalman_sensor
+{
+    int dim;
+    const real_t *H;
+    const real_t *R;
+    const real_t *z;
+} kalman_sensor_t;
+
+/**
+ * Add the information contribution of one sensor to the information matrix
+ * Y (nx x nx) and information vector yv (nx):
+ *   Y += H.T * inv(R) * H, yv += H.T * inv(R) * z
+ * Contributions are additive, so sensors can be accumulated in any order or
+ * into separate partial sums that are added afterwards. A sensor dim outside
+ * 1..KALMAN_SENSOR_MAX_DIM fails with MATMUL_DIMENSION_MISMATCH_ERROR.
+ */
+static inline int kalman_information_add(const kalman_sensor_t *sensor, int nx, real_t *Y, real_t *yv,
+                                         int *errorcode)
+{
+    int m = sensor->dim;
+    if (m < 1 || m > KALMAN_SENSOR_MAX_DIM)
+    {
+        fprintf(stderr, "sensor dimension %d outside 1..%d, errorcode %d\n", m, KALMAN_SENSOR_MAX_DIM,
+                MATMUL_DIMENSION_MISMATCH_ERROR);
+        *errorcode = MATMUL_DIMENSION_MISMATCH_ERROR;
+        return 0;
+    }
+    real_t R_copy[m * m], invR[m * m], HtinvR[nx * m];
+
+    for (int i = 0; i < m * m; i++)
+        R_copy[i] = sensor->R[i];
+    if (!kalman_invert(R_copy, invR, m, errorcode))
+        return 0;
+
+    // HtinvR = H.T * inv(R)
+    for (int row = 0; row < nx; row++)
+    {
+        for (int col = 0; col < m; col++)
+        {
+            real_t res = 0;
+            for (int i = 0; i < m; i++)
+                res += sensor->H[i * nx + row] * invR[i * m + col];
+            HtinvR[row * m + col] = res;
+        }
+    }
+
+    for (int row = 0; row < nx; row++)
+    {
+        real_t info = 0;
+        for (int i = 0; i < m; i++)
+            info += HtinvR[row * m + i] * sensor->z[i];
+        yv[row] += info;
+
+        for (int col = 0; col < nx; col++)
+        {
+            real_t res = 0;
+            for (int i = 0; i < m; i++)
+                res += HtinvR[row * m + i] * sensor->H[i * nx + col];
+            Y[row * nx + col] += res;
+        }
+    }
+    return 1;
+}
+
+#define KALMAN_FILTER_DEFINE(name, NX, NZ, NU)                                        \
+    typedef struct name                                                               \
+    {                                                                                 \
+        real_t x[(NX)];         /* state estimate */                                  \
+        real_t P[(NX) * (NX)];  /* estimate covariance */                             \
+        real_t F[(NX) * (NX)];  /* state model matrix */                              \
+        real_t Ft[(NX) * (NX)]; /* cached transpose of F */                           \
+        real_t B[(NX) * (NU)];  /* control matrix */                                  \
+        real_t H[(NZ) * (NX)];  /* observation matrix */                              \
+        real_t Ht[(NX) * (NZ)]; /* cached transpose of H */                           \
+        real_t Q[(NX) * (NX)];  /* process noise matrix */                            \
+        real_t R[(NZ) * (NZ)];  /* measurement noise matrix */                        \
+        real_t y[(NZ)];         /* residual of the last update */                     \
+    } name##_t;                                                                       \
+                                                                                      \
+    static inline void name##_commit_model(name##_t *kf)                              \
+    {                                                                                 \
+        kalman_transpose(kf->F, kf->Ft, (NX), (NX));                                  \
+        kalman_transpose(kf->H, kf->Ht, (NZ), (NX));                                  \
+    }                                                                                 \
+                                                                                      \
+    static inline void name##_init(name##_t *kf)                                      \
+    {                                                                                 \
+        real_t *raw = (real_t *)kf;                                                   \
+        for (unsigned long i = 0; i < sizeof(name##_t) / sizeof(real_t); i++)         \
+            raw[i] = 0;                                                               \
+        for (int i = 0; i < (NX); i++)                                                \
+        {                                                                             \
+            kf->F[i * (NX) + i] = 1;                                                  \
+            kf->P[i * (NX) + i] = 1;                                                  \
+        }                                                                             \
+        name##_commit_model(kf);                                                      \
+    }                                                                                 \
+                                                                                      \
+    static inline int name##_predict(const name##_t *kf, const real_t *u,             \
+                                     real_t *x_pred, real_t *P_pred, int *errorcode)  \
+    {                                                                                 \
+        (void)errorcode;                                                              \
+        real_t Fx[(NX)], Bu[(NX)];                                                    \
+        real_t FP[(NX) * (NX)], FPFt[(NX) * (NX)];                                    \
+                                                                                      \
+        kalman_gemm(kf->F, kf->x, Fx, (NX), (NX), 1);                                 \
+        kalman_gemm(kf->B, u, Bu, (NX), (NU), 1);                                     \
+        kalman_add(Fx, Bu, x_pred, (NX));                                             \
+                                                                                      \
+        kalman_gemm(kf->F, kf->P, FP, (NX), (NX), (NX));                              \
+        kalman_gemm(FP, kf->Ft, FPFt, (NX), (NX), (NX));                              \
+        kalman_add(FPFt, kf->Q, P_pred, (NX) * (NX));                                 \
+        return 1;                                                                     \
+    }                                                                                 \
+                                                                                      \
+    static inline int name##_update(name##_t *kf, const real_t *x_pred,               \
+                                    const real_t *P_pred, const real_t *z,            \
+                                    int *errorcode)                                   \
+    {                                                                                 \
+        real_t Hx[(NZ)], Ky[(NX)];                                                    \
+        real_t PHt[(NX) * (NZ)], Sk[(NZ) * (NZ)], invSk[(NZ) * (NZ)];                 \
+        real_t Kk[(NX) * (NZ)], KH[(NX) * (NX)];                                      \
+                                                                                      \
+        /* yk = zk - H * x_pred */                                                    \
+        kalman_gemm(kf->H, x_pred, Hx, (NZ), (NX), 1);                                \
+        kalman_sub(z, Hx, kf->y, (NZ));                                               \
+                                                                                      \
+        /* Sk = H * P_pred * H.T + R */                                               \
+        kalman_gemm(P_pred, kf->Ht, PHt, (NX), (NX), (NZ));                           \
+        kalman_gemm(kf->H, PHt, Sk, (NZ), (NX), (NZ));                                \
+        kalman_add(Sk, kf->R, Sk, (NZ) * (NZ));                                       \
+                                                                                      \
+        /* Kk = P_pred * H.T * inv(Sk) */                                             \
+        if (!kalman_invert(Sk, invSk, (NZ), errorcode))                               \
+            return 0;                                                                 \
+        kalman_gemm(PHt, invSk, Kk, (NX), (NZ), (NZ));                                \
+                                                                                      \
+        /* xkk = x_pred + Kk * yk */                                                  \
+        kalman_gemm(Kk, kf->y, Ky, (NX), (NZ), 1);                                    \
+        kalman_add(x_pred, Ky, kf->x, (NX));                                          \
+                                                                                      \
+        /* Pkk = (Id - Kk * H) * P_pred */                                            \
+        kalman_gemm(Kk, kf->H, KH, (NX), (NZ), (NX));                                 \
+        for (int i = 0; i < (NX) * (NX); i++)                                         \
+            KH[i] = -KH[i];                                                           \
+        for (int i = 0; i < (NX); i++)                                                \
+            KH[i * (NX) + i] += 1;                                                    \
+        kalman_gemm(KH, P_pred, kf->P, (NX), (NX), (NX));                             \
+        return 1;                                                                     \
+    }                                                                                 \
+                                                                                      \
+    static inline int name##_iterate(name##_t *kf, const real_t *u, const real_t *z,  \
+                                     int *errorcode)                                  \
+    {                                                                                 \
+        real_t x_pred[(NX)], P_pred[(NX) * (NX)];                                     \
+        if (!name##_predict(kf, u, x_pred, P_pred, errorcode))                        \
+            return 0;                                                                 \
+        return name##_update(kf, x_pred, P_pred, z, errorcode);                       \
+    }                                                                                 \
+                                                                                      \
+    /* information form update: the cost grows linearly with num_sensors. */          \
+    /* With Ys, ys the summed sensor information H.T*inv(R)*H, H.T*inv(R)*z */        \
+    /*   P = inv(inv(P_pred) + Ys) = inv(Id + P_pred*Ys) * P_pred          */         \
+    /*   x = P * (inv(P_pred)*x_pred + ys) = inv(Id + P_pred*Ys) *         */         \
+    /*       (x_pred + P_pred*ys)                                          */         \
+    /* so one solve with the well conditioned Id + P_pred*Ys gives both,   */         \
+    /* P_pred is never inverted. kf->H and kf->R are not used, each sensor */         \
+    /* brings its own                                                      */         \
+    static inline int name##_update_information(name##_t *kf, const real_t *x_pred,   \
+                                                const real_t *P_pred,                 \
+                                                const kalman_sensor_t *sensors,       \
+                                                int num_sensors, int *errorcode)      \
+    {                                                                                 \
+        real_t Ys[(NX) * (NX)], ys[(NX)], IPY[(NX) * (NX)], Pys[(NX)];                \
+        real_t rhs[(NX) * ((NX) + 1)];                                                \
+                                                                                      \
+        for (int i = 0; i < (NX) * (NX); i++)                                         \
+            Ys[i] = 0;                                                                \
+        for (int i = 0; i < (NX); i++)                                                \
+            ys[i] = 0;                                                                \
+        for (int s = 0; s < num_sensors; s++)                                         \
+        {                                                                             \
+            if (!kalman_information_add(&sensors[s], (NX), Ys, ys, errorcode))        \
+                return 0;                                                             \
+        }                                                                             \
+                                                                                      \
+        /* IPY = Id + P_pred * Ys, rhs = [P_pred | x_pred + P_pred * ys] */           \
+        kalman_gemm(P_pred, Ys, IPY, (NX), (NX), (NX));                               \
+        for (int i = 0; i < (NX); i++)                                                \
+            IPY[i * (NX) + i] += 1;                                                   \
+        kalman_gemm(P_pred, ys, Pys, (NX), (NX), 1);                                  \
+        for (int row = 0; row < (NX); row++)                                          \
+        {                                                                             \
+            for (int col = 0; col < (NX); col++)                                      \
+                rhs[row * ((NX) + 1) + col] = P_pred[row * (NX) + col];               \
+            rhs[row * ((NX) + 1) + (NX)] = x_pred[row] + Pys[row];                    \
+        }                                                                             \
+                                                                                      \
+        if (!kalman_solve(IPY, rhs, (NX), (NX) + 1, errorcode))                       \
+            return 0;                                                                 \
+        for (int row = 0; row < (NX); row++)                                          \
+        {                                                                             \
+            for (int col = 0; col < (NX); col++)                                      \
+                kf->P[row * (NX) + col] = rhs[row * ((NX) + 1) + col];                \
+            kf->x[row] = rhs[row * ((NX) + 1) + (NX)];                                \
+        }                                                                             \
+        return 1;                                                                     \
+    }
+
+#endif
@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include "kalman_imm.h"
+#include "sensor_handlers.h"
+
+#define L IMM_LANES
+#define NX dimState
+#define NZ numRowH
+
+// lower bound of the mode probabilities. A mode ruled out by a large
+// residual would otherwise fall to probabilities whose products in the
+// mixing underflow to subnormals and slow every step several times
+#define IMM_MIN_PROBABILITY 1e-4
+// below this log likelihood relative to the best mode exp underflows
+#define IMM_MIN_LOG_LIKELIHOOD -60
+
+// the modes of imm_init_flight_modes: the vertical process noise of the
+// ballistic and parachute modes relative to the powered one, which carries
+// the noise of the measured acceleration
+#define IMM_FREE_FLIGHT_Z_Q_SCALE 0.01f
+#define IMM_PARACHUTE_RESPONSE 0.5f      // 1/s
+#define IMM_PARACHUTE_DESCENT_RATE -8.0f // m/s
+#define IMM_STAY_PROBABILITY 0.98f
+// spread of the vertical acceleration the powered mode accepts, so any
+// measured acceleration fits it about equally well
+#define IMM_POWERED_ACCEL_SPREAD 10.0f // m/s^2
+
+/**
+ * c = a * b for every lane, a is rows x inner and b is inner x cols.
+ * The lane loop is the SIMD loop. Two columns are accumulated at once so
+ * there are two independent add chains.
+ */
+static inline void lanes_gemm(imm_lanes_t *restrict a, imm_lanes_t *restrict b, imm_lanes_t *restrict c,
+                              int rows, int inner, int cols)
+{
+    for (int row = 0; row < rows; row++)
+    {
+        for (int col = 0; col < cols; col += 2)
+        {
+            int col2 = col + 1 < cols ? col + 1 : col;
+            real_t res[L] = {0}, res2[L] = {0};
+            for (int i = 0; i < inner; i++)
+                for (int l = 0; l < L; l++)
+                {
+                    res[l] += a[row * inner + i][l] * b[i * cols + col][l];
+                    res2[l] += a[row * inner + i][l] * b[i * cols + col2][l];
+                }
+            for (int l = 0; l < L; l++)
+            {
+                c[row * cols + col][l] = res[l];
+                c[row * cols + col2][l] = res2[l];
+            }
+        }
+    }
+}
+
+static inline void lanes_add(imm_lanes_t *a, imm_lanes_t *b, imm_lanes_t *out, int n)
+{
+    for (int i = 0; i < n; i++)
+        for (int l = 0; l < L; l++)
+            out[i][l] = a[i][l] + b[i][l];
+}
+
+static void lanes_broadcast(const float *v, imm_lanes_t *out, int n)
+{
+    for (int i = 0; i < n; i++)
+        for (int l = 0; l < L; l++)
+            out[i][l] = v[i];
+}
+
+static void scatter(const real_t *src, imm_lanes_t *dst, int n, int lane)
+{
+    for (int i = 0; i < n; i++)
+        dst[i][lane] = src[i];
+}
+
+/**
+ * invert the 3x3 matrix s of every lane by cofactors, det receives the
+ * determinants. Returns 0 if any lane is singular under the test of inv3x3,
+ * |det| below MAT_INV_RELATIVE_TOL times the product of the row norms.
+ */
+static int lanes_inv3x3(imm_lanes_t *s, imm_lanes_t *inv_s, real_t *det, int *errorcode)
+{
+    int singular = 0;
+    for (int l = 0; l < L; l++)
+    {
+        real_t a11 = s[0][l], a12 = s[1][l], a13 = s[2][l];
+        real_t a21 = s[3][l], a22 = s[4][l], a23 = s[5][l];
+        real_t a31 = s[6][l], a32 = s[7][l], a33 = s[8][l];
+
+        real_t c11 = a22 * a33 - a32 * a23, c12 = a31 * a23 - a21 * a33, c13 = a21 * a32 - a31 * a22;
+        real_t c21 = a32 * a13 - a12 * a33, c22 = a11 * a33 - a31 * a13, c23 = a31 * a12 - a11 * a32;
+        real_t c31 = a12 * a23 - a22 * a13, c32 = a21 * a13 - a11 * a23, c33 = a11 * a22 - a21 * a12;
+
+        det[l] = a11 * c11 + a12 * c12 + a13 * c13;
+        double row_norms = (fabs((double)a11) + fabs((double)a12) + fabs((double)a13)) *
+                           (fabs((double)a21) + fabs((double)a22) + fabs((double)a23)) *
+                           (fabs((double)a31) + fabs((double)a32) + fabs((double)a33));
+        singular |= det[l] == 0 || fabs((double)det[l]) < MAT_INV_RELATIVE_TOL * row_norms;
+        real_t inv_det = 1 / det[l];
+
+        // transposed cofactor matrix over the determinant
+        inv_s[0][l] = c11 * inv_det, inv_s[1][l] = c21 * inv_det, inv_s[2][l] = c31 * inv_det;
+        inv_s[3][l] = c12 * inv_det, inv_s[4][l] = c22 * inv_det, inv_s[5][l] = c32 * inv_det;
+        inv_s[6][l] = c13 * inv_det, inv_s[7][l] = c23 * inv_det, inv_s[8][l] = c33 * inv_det;
+    }
+    if (singular)
+    {
+        fprintf(stderr, "Error: taking inverse of non-invertible matrix!");
+        *errorcode = MAT_INV_SINGULAR_MATRIX_ERROR;
+        return 0;
+    }
+    return 1;
+}
+
+_Static_assert(numRowH == 3, "imm_step inverts the residual covariance as 3x3");
+
+void imm_commit_modes(imm_filter_t *imm)
+{
+    for (int l = 0; l < L; l++)
+    {
+        // padding lanes repeat mode 0 so they stay well conditioned
+        kf6_t *mode = &imm->modes[l < imm->num_modes ? l : 0];
+        kf6_commit_model(mode);
+        scatter(mode->F, imm->F, NX * NX, l);
+        scatter(mode->Ft, imm->Ft, NX * NX, l);
+        scatter(mode->B, imm->B, NX * numColB, l);
+        scatter(mode->H, imm->H, NZ * NX, l);
+        scatter(mode->Ht, imm->Ht, NX * NZ, l);
+        scatter(mode->Q, imm->Q, NX * NX, l);
+        scatter(mode->R, imm->R, NZ * NZ, l);
+        scatter(imm->offsets[l < imm->num_modes ? l : 0], imm->offset, NX, l);
+    }
+}
+
+int imm_init(imm_filter_t *imm, const kalman_tuning_t *tunings, int num_modes, const real_t *transition)
+{
+    if (num_modes < 1 || num_modes > L)
+    {
+        fprintf(stderr, "imm: %d modes, at most %d supported\n", num_modes, L);
+        return 0;
+    }
+
+    imm->num_modes = num_modes;
+    for (int j = 0; j < L; j++)
+    {
+        imm->tunings[j] = tunings[j < num_modes ? j : 0];
+        kalman_model_init(&imm->modes[j], &imm->tunings[j]);
+        imm->mu[j] = j < num_modes ? 1 / (real_t)num_modes : 0;
+        for (int i = 0; i < L; i++)
+            imm->transition[i][j] = (i < num_modes && j < num_modes) ? transition[i * num_modes + j] : 0;
+        for (int e = 0; e < NX; e++)
+            imm->offsets[j][e] = 0;
+        imm->accel_bias[j] = imm->accel_gain[j] = imm->accel_variance[j] = 0;
+
+        scatter(imm->modes[j].x, imm->x, NX, j);
+        scatter(imm->modes[j].P, imm->P, NX * NX, j);
+    }
+    imm_commit_modes(imm);
+    return 1;
+}
+
+// scale the process noise of the vertical axis, z and vz, of mode
+static void scale_vertical_Q(kf6_t *mode, real_t scale)
+{
+    mode->Q[2 * NX + 2] *= scale;
+    mode->Q[2 * NX + 5] *= scale;
+    mode->Q[5 * NX + 2] *= scale;
+    mode->Q[5 * NX + 5] *= scale;
+}
+
+int imm_init_flight_modes(imm_filter_t *imm)
+{
+    kalman_tuning_t tunings[IMM_FLIGHT_MODES];
+    real_t transition[IMM_FLIGHT_MODES * IMM_FLIGHT_MODES];
+
+    for (int i = 0; i < IMM_FLIGHT_MODES; i++)
+    {
+        kalman_default_tuning(&tunings[i]);
+        for (int j = 0; j < IMM_FLIGHT_MODES; j++)
+            transition[i * IMM_FLIGHT_MODES + j] =
+                i == j ? (real_t)IMM_STAY_PROBABILITY : (real_t)(1.0f - IMM_STAY_PROBABILITY) / (IMM_FLIGHT_MODES - 1);
+    }
+    if (!imm_init(imm, tunings, IMM_FLIGHT_MODES, transition))
+        return 0;
+
+    // ballistic and parachute drop the measured vertical acceleration, x and
+    // y still take theirs. Both are exact over one step of Dt
+    kf6_t *ballistic = &imm->modes[IMM_MODE_BALLISTIC];
+    ballistic->B[2 * numColB + 2] = ballistic->B[5 * numColB + 2] = 0;
+    imm->offsets[IMM_MODE_BALLISTIC][2] = -0.5f * g * Dt * Dt;
+    imm->offsets[IMM_MODE_BALLISTIC][5] = -g * Dt;
+    imm->accel_bias[IMM_MODE_BALLISTIC] = -g;
+    scale_vertical_Q(ballistic, (real_t)IMM_FREE_FLIGHT_Z_Q_SCALE);
+
+    // vz relaxes to the descent rate: a = k * (rate - vz) over the step
+    const real_t k = IMM_PARACHUTE_RESPONSE, rate = IMM_PARACHUTE_DESCENT_RATE;
+    kf6_t *parachute = &imm->modes[IMM_MODE_PARACHUTE];
+    parachute->B[2 * numColB + 2] = parachute->B[5 * numColB + 2] = 0;
+    parachute->F[2 * NX + 5] = Dt - 0.5f * k * Dt * Dt;
+    parachute->F[5 * NX + 5] = 1 - k * Dt;
+    imm->offsets[IMM_MODE_PARACHUTE][2] = 0.5f * k * rate * Dt * Dt;
+    imm->offsets[IMM_MODE_PARACHUTE][5] = k * rate * Dt;
+    imm->accel_bias[IMM_MODE_PARACHUTE] = k * rate;
+    imm->accel_gain[IMM_MODE_PARACHUTE] = -k;
+    scale_vertical_Q(parachute, (real_t)IMM_FREE_FLIGHT_Z_Q_SCALE);
+
+    // the measured vertical acceleration tells the modes apart within a
+    // step, the barometer only after the wrong vz has moved the altitude.
+    // Powered takes any acceleration, the other two the one they predict
+    // within the accelerometer noise
+    for (int j = 0; j < IMM_FLIGHT_MODES; j++)
+        imm->accel_variance[j] = tunings[j].accel_variance;
+    imm->accel_variance[IMM_MODE_POWERED] = IMM_POWERED_ACCEL_SPREAD * IMM_POWERED_ACCEL_SPREAD;
+
+    // the rocket starts on the pad, where only the powered mode fits
+    for (int j = 0; j < IMM_FLIGHT_MODES; j++)
+        imm->mu[j] = j == IMM_MODE_POWERED;
+    imm_commit_modes(imm);
+    return 1;
+}
+
+/**
+ * interaction: mix the mode estimates into the starting point of every mode.
+ * Padding lanes mix only with themselves, so every loop runs over all lanes
+ * and the innermost one over the target mode j vectorizes.
+ */
+static void imm_mix(imm_filter_t *imm, real_t *c)
+{
+    int n = imm->num_modes;
+    real_t w[L][L];
+    imm_lanes_t x_mixed[NX], P_mixed[NX * NX];
+
+    for (int j = 0; j < L; j++)
+    {
+        c[j] = 0;
+        for (int i = 0; i < n; i++)
+            c[j] += imm->transition[i][j] * imm->mu[i];
+        for (int i = 0; i < L; i++)
+            w[i][j] = c[j] > 0 ? imm->transition[i][j] * imm->mu[i] / c[j] : (real_t)(i == j);
+    }
+
+    for (int e = 0; e < NX; e++)
+    {
+        for (int j = 0; j < L; j++)
+            x_mixed[e][j] = 0;
+        for (int i = 0; i < L; i++)
+            for (int j = 0; j < L; j++)
+                x_mixed[e][j] += w[i][j] * imm->x[e][i];
+    }
+
+    for (int e = 0; e < NX * NX; e++)
+        for (int j = 0; j < L; j++)
+            P_mixed[e][j] = 0;
+    for (int i = 0; i < L; i++)
+    {
+        imm_lanes_t dx[NX];
+        for (int e = 0; e < NX; e++)
+            for (int j = 0; j < L; j++)
+                dx[e][j] = imm->x[e][i] - x_mixed[e][j];
+        for (int r = 0; r < NX; r++)
+            for (int col = 0; col < NX; col++)
+                for (int j = 0; j < L; j++)
+                    P_mixed[r * NX + col][j] += w[i][j] * (imm->P[r * NX + col][i] + dx[r][j] * dx[col][j]);
+    }
+
+    memcpy(imm->x, x_mixed, sizeof(x_mixed));
+    memcpy(imm->P, P_mixed, sizeof(P_mixed));
+}
+
+int imm_step(imm_filter_t *imm, const float *ak, const float *zk, float pressure, int *errorcode)
+{
+    int n = imm->num_modes;
+    real_t c[L], log_likelihood[L];
+    real_t det[L];
+    imm_lanes_t u[numColB], z[NZ];
+    imm_lanes_t Fx[NX], Bu[NX], x_pred[NX];
+    imm_lanes_t FP[NX * NX], P_pred[NX * NX];
+    imm_lanes_t Hx[NZ], y[NZ], PHt[NX * NZ], Sk[NZ * NZ], invSk[NZ * NZ];
+    imm_lanes_t Kk[NX * NZ], Ky[NX], KH[NX * NX], invS_y[NZ];
+
+    imm_mix(imm, c);
+
+    // residual and variance of the measured vertical acceleration, from the
+    // mixed vz every mode starts the step with
+    int use_accel = 1;
+    real_t accel_r[L], accel_s[L];
+    for (int j = 0; j < n; j++)
+    {
+        use_accel &= imm->accel_variance[j] > 0;
+        accel_r[j] = (real_t)ak[2] - imm->accel_bias[j] - imm->accel_gain[j] * imm->x[5][j];
+        accel_s[j] = imm->accel_variance[j] + imm->accel_gain[j] * imm->accel_gain[j] * imm->P[5 * NX + 5][j];
+    }
+
+    for (int j = 0; j < L; j++)
+    {
+        kf6_t *mode = &imm->modes[j < n ? j : 0];
+        kalman_model_update_R(mode, &imm->tunings[j], pressure);
+        scatter(mode->R, imm->R, NZ * NZ, j);
+    }
+    lanes_broadcast(ak, u, numColB);
+    lanes_broadcast(zk, z, NZ);
+
+    // predict every mode: x_pred = F * x + B * u + offset, P_pred = F * P * F.T + Q
+    lanes_gemm(imm->F, imm->x, Fx, NX, NX, 1);
+    lanes_gemm(imm->B, u, Bu, NX, numColB, 1);
+    lanes_add(Fx, Bu, x_pred, NX);
+    lanes_add(x_pred, imm->offset, x_pred, NX);
+    lanes_gemm(imm->F, imm->P, FP, NX, NX, NX);
+    lanes_gemm(FP, imm->Ft, P_pred, NX, NX, NX);
+    lanes_add(P_pred, imm->Q, P_pred, NX * NX);
+
+    // update every mode
+    lanes_gemm(imm->H, x_pred, Hx, NZ, NX, 1);
+    for (int i = 0; i < NZ; i++)
+        for (int l = 0; l < L; l++)
+            y[i][l] = z[i][l] - Hx[i][l];
+    lanes_gemm(P_pred, imm->Ht, PHt, NX, NX, NZ);
+    lanes_gemm(imm->H, PHt, Sk, NZ, NX, NZ);
+    lanes_add(Sk, imm->R, Sk, NZ * NZ);
+    if (!lanes_inv3x3(Sk, invSk, det, errorcode))
+        return 0;
+    lanes_gemm(PHt, invSk, Kk, NX, NZ, NZ);
+
+    lanes_gemm(Kk, y, Ky, NX, NZ, 1);
+    lanes_add(x_pred, Ky, imm->x, NX);
+    lanes_gemm(Kk, imm->H, KH, NX, NZ, NX);
+    for (int i = 0; i < NX * NX; i++)
+        for (int l = 0; l < L; l++)
+            KH[i][l] = -KH[i][l];
+    for (int i = 0; i < NX; i++)
+        for (int l = 0; l < L; l++)
+            KH[i * NX + i][l] += 1;
+    lanes_gemm(KH, P_pred, imm->P, NX, NX, NX);
+
+    // Gaussian log likelihood of every residual, plus that of the measured
+    // vertical acceleration under the mode's expectation of it
+    lanes_gemm(invSk, y, invS_y, NZ, NZ, 1);
+    for (int l = 0; l < L; l++)
+    {
+        real_t d2 = 0;
+        for (int i = 0; i < NZ; i++)
+            d2 += y[i][l] * invS_y[i][l];
+        log_likelihood[l] = -d2 / 2 - (real_t)log((double)det[l]) / 2 - (real_t)(NZ * log(6.283185307179586) / 2);
+    }
+    if (use_accel)
+        for (int j = 0; j < n; j++)
+            log_likelihood[j] += -accel_r[j] * accel_r[j] / accel_s[j] / 2 - (real_t)log((double)accel_s[j]) / 2 -
+                                 (real_t)(log(6.283185307179586) / 2);
+
+    // mode probabilities, shifted by the largest log likelihood for range
+    real_t max_log = log_likelihood[0], total = 0;
+    for (int j = 1; j < n; j++)
+        if (log_likelihood[j] > max_log)
+            max_log = log_likelihood[j];
+    for (int j = 0; j < n; j++)
+    {
+        real_t shifted = log_likelihood[j] - max_log;
+        imm->mu[j] = shifted > (real_t)IMM_MIN_LOG_LIKELIHOOD ? c[j] * (real_t)exp((double)shifted) : 0;
+        total += imm->mu[j];
+    }
+    for (int j = 0; j < n; j++)
+        imm->mu[j] = total > 0 ? imm->mu[j] / total : 1 / (real_t)n;
+    total = 0;
+    for (int j = 0; j < n; j++)
+    {
+        if (imm->mu[j] < (real_t)IMM_MIN_PROBABILITY)
+            imm->mu[j] = (real_t)IMM_MIN_PROBABILITY;
+        total += imm->mu[j];
+    }
+    for (int j = 0; j < n; j++)
+        imm->mu[j] /= total;
+
+    // combined estimate, padding lanes have mu = 0
+    imm_lanes_t dx[NX];
+    for (int e = 0; e < NX; e++)
+    {
+        real_t sum = 0;
+        for (int l = 0; l < L; l++)
+            sum += imm->mu[l] * imm->x[e][l];
+        imm->x_combined[e] = sum;
+        for (int l = 0; l < L; l++)
+            dx[e][l] = imm->x[e][l] - sum;
+    }
+    for (int r = 0; r < NX; r++)
+        for (int col = 0; col < NX; col++)
+        {
+            real_t sum = 0;
+            for (int l = 0; l < L; l++)
+                sum += imm->mu[l] * (imm->P[r * NX + col][l] + dx[r][l] * dx[col][l]);
+            imm->P_combined[r * NX + col] = sum;
+        }
+    return 1;
+}
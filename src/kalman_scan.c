@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "kalman_scan.h"
+
+#define NX dimState
+
+typedef struct scan_job
+{
+    const kf6_t *kf;
+    const kalman_tuning_t *tuning;
+    const flight_log_t *log;
+    kalman_scan_element_t *elements;
+    int begin, end; // range of steps handled by this thread
+    int errorcode;
+} scan_job_t;
+
+static void identity_plus(const real_t *a, real_t *out)
+{
+    for (int i = 0; i < NX * NX; i++)
+        out[i] = a[i];
+    for (int i = 0; i < NX; i++)
+        out[i * NX + i] += 1;
+}
+
+/**
+ * Build the element of step k: the filter for x_k given x_(k-1) = 0 as a
+ * function of x_(k-1), with the first step conditioned on the prior in kf.
+ */
+static int build_element(const kf6_t *kf, const kalman_tuning_t *tuning, const flight_step_t *step,
+                         int first, kalman_scan_element_t *e, int *errorcode)
+{
+    kf6_t model = *kf;
+    real_t m[NX], Pm[NX * NX], FP[NX * NX];
+    real_t PHt[NX * numRowH], Sk[numRowH * numRowH], invSk[numRowH * numRowH];
+    real_t Kk[NX * numRowH], KH[NX * NX], Hm[numRowH], y[numRowH];
+    real_t u[numColB], z[numRowH];
+
+    for (int i = 0; i < numColB; i++)
+        u[i] = step->ak[i];
+    for (int i = 0; i < numRowH; i++)
+        z[i] = step->zk[i];
+    kalman_model_update_R(&model, tuning, step->pressure);
+
+    // predicted mean and covariance: from the prior for the first step,
+    // otherwise only the control input and the process noise
+    kalman_gemm(model.B, u, m, NX, numColB, 1);
+    if (first)
+    {
+        real_t Fx[NX];
+        kalman_gemm(model.F, model.x, Fx, NX, NX, 1);
+        kalman_add(Fx, m, m, NX);
+        kalman_gemm(model.F, model.P, FP, NX, NX, NX);
+        kalman_gemm(FP, model.Ft, Pm, NX, NX, NX);
+        kalman_add(Pm, model.Q, Pm, NX * NX);
+    }
+    else
+    {
+        for (int i = 0; i < NX * NX; i++)
+            Pm[i] = model.Q[i];
+    }
+
+    // Kk = Pm * H.T * inv(H * Pm * H.T + R)
+    kalman_gemm(Pm, model.Ht, PHt, NX, NX, numRowH);
+    kalman_gemm(model.H, PHt, Sk, numRowH, NX, numRowH);
+    kalman_add(Sk, model.R, Sk, numRowH * numRowH);
+    if (!kalman_invert(Sk, invSk, numRowH, errorcode))
+        return 0;
+    kalman_gemm(PHt, invSk, Kk, NX, numRowH, numRowH);
+
+    // b = m + Kk * (zk - H * m), C = (Id - Kk * H) * Pm
+    kalman_gemm(model.H, m, Hm, numRowH, NX, 1);
+    kalman_sub(z, Hm, y, numRowH);
+    kalman_gemm(Kk, y, e->b, NX, numRowH, 1);
+    kalman_add(m, e->b, e->b, NX);
+
+    kalman_gemm(Kk, model.H, KH, NX, numRowH, NX);
+    for (int i = 0; i < NX * NX; i++)
+        KH[i] = -KH[i];
+    for (int i = 0; i < NX; i++)
+        KH[i * NX + i] += 1;
+    kalman_gemm(KH, Pm, e->C, NX, NX, NX);
+
+    if (first)
+    {
+        for (int i = 0; i < NX * NX; i++)
+            e->A[i] = e->J[i] = 0;
+        for (int i = 0; i < NX; i++)
+            e->eta[i] = 0;
+        return 1;
+    }
+
+    // A = (Id - Kk * H) * F
+    kalman_gemm(KH, model.F, e->A, NX, NX, NX);
+
+    // eta = F.T * H.T * inv(Sk) * (zk - H * m), J = F.T * H.T * inv(Sk) * H * F
+    real_t HtinvS[NX * numRowH], FtHtinvS[NX * numRowH], HF[numRowH * NX];
+    kalman_gemm(model.Ht, invSk, HtinvS, NX, numRowH, numRowH);
+    kalman_gemm(model.Ft, HtinvS, FtHtinvS, NX, NX, numRowH);
+    kalman_gemm(FtHtinvS, y, e->eta, NX, numRowH, 1);
+    kalman_gemm(model.H, model.F, HF, numRowH, NX, NX);
+    kalman_gemm(FtHtinvS, HF, e->J, NX, numRowH, NX);
+    return 1;
+}
+
+/**
+ * out = first combined with second, where first covers the earlier steps.
+ * out may be the same element as second.
+ */
+static int combine(const kalman_scan_element_t *first, const kalman_scan_element_t *second,
+                   kalman_scan_element_t *out, int *errorcode)
+{
+    real_t M_data[NX * NX], Mt_data[NX * NX], T1t[NX * NX], T2t[NX * NX];
+    real_t T1[NX * NX], T2[NX * NX], Ajt[NX * NX], tmp[NX * NX];
+    real_t v[NX], w[NX];
+    kalman_scan_element_t r;
+
+    // M = Id + C_i * J_j; C and J are symmetric, so M.T = Id + J_j * C_i.
+    // T1 = A_j * inv(M) and T2 = A_i.T * inv(M).T come from two fixed-size
+    // solves, T1.T = inv(M.T) * A_j.T and T2.T = inv(M) * A_i, without
+    // forming inv(M)
+    kalman_gemm(first->C, second->J, tmp, NX, NX, NX);
+    identity_plus(tmp, M_data);
+    kalman_transpose(M_data, Mt_data, NX, NX);
+    kalman_transpose(second->A, Ajt, NX, NX);
+    for (int i = 0; i < NX * NX; i++)
+    {
+        T1t[i] = Ajt[i];
+        T2t[i] = first->A[i];
+    }
+    if (!kalman_solve(Mt_data, T1t, NX, NX, errorcode) || !kalman_solve(M_data, T2t, NX, NX, errorcode))
+        return 0;
+    kalman_transpose(T1t, T1, NX, NX);
+    kalman_transpose(T2t, T2, NX, NX);
+
+    // A = T1 * A_i
+    kalman_gemm(T1, first->A, r.A, NX, NX, NX);
+
+    // b = T1 * (b_i + C_i * eta_j) + b_j
+    kalman_gemm(first->C, second->eta, v, NX, NX, 1);
+    kalman_add(first->b, v, v, NX);
+    kalman_gemm(T1, v, w, NX, NX, 1);
+    kalman_add(w, second->b, r.b, NX);
+
+    // C = T1 * C_i * A_j.T + C_j
+    kalman_gemm(T1, first->C, tmp, NX, NX, NX);
+    kalman_gemm(tmp, Ajt, r.C, NX, NX, NX);
+    kalman_add(r.C, second->C, r.C, NX * NX);
+
+    // eta = T2 * (eta_j - J_j * b_i) + eta_i
+    kalman_gemm(second->J, first->b, v, NX, NX, 1);
+    kalman_sub(second->eta, v, v, NX);
+    kalman_gemm(T2, v, w, NX, NX, 1);
+    kalman_add(w, first->eta, r.eta, NX);
+
+    // J = T2 * J_j * A_i + J_i
+    kalman_gemm(T2, second->J, tmp, NX, NX, NX);
+    kalman_gemm(tmp, first->A, r.J, NX, NX, NX);
+    kalman_add(r.J, first->J, r.J, NX * NX);
+
+    *out = r;
+    return 1;
+}
+
+// phase 1: build the elements of a block and scan within the block
+static void *scan_block(void *arg)
+{
+    scan_job_t *job = arg;
+    for (int k = job->begin; k < job->end; k++)
+    {
+        if (!build_element(job->kf, job->tuning, &job->log->steps[k], k == 0,
+                           &job->elements[k], &job->errorcode))
+            return NULL;
+        if (k > job->begin &&
+            !combine(&job->elements[k - 1], &job->elements[k], &job->elements[k], &job->errorcode))
+            return NULL;
+    }
+    return NULL;
+}
+
+// phase 3: prepend the prefix of all earlier blocks to a block
+static void *apply_prefix(void *arg)
+{
+    scan_job_t *job = arg;
+    const kalman_scan_element_t *prefix = &job->elements[job->begin - 1];
+    // the last element already got its prefix in phase 2
+    for (int k = job->begin; k < job->end - 1; k++)
+    {
+        if (!combine(prefix, &job->elements[k], &job->elements[k], &job->errorcode))
+            return NULL;
+    }
+    return NULL;
+}
+
+static int run_phase(scan_job_t *jobs, int first_thread, int num_threads, void *(*phase)(void *),
+                     int *errorcode)
+{
+    pthread_t threads[num_threads];
+    int started[num_threads];
+    for (int t = first_thread; t < num_threads; t++)
+    {
+        started[t] = pthread_create(&threads[t], NULL, phase, &jobs[t]) == 0;
+        if (!started[t])
+            phase(&jobs[t]); // fall back to running the block on this thread
+    }
+    for (int t = first_thread; t < num_threads; t++)
+    {
+        if (started[t])
+            pthread_join(threads[t], NULL);
+    }
+    for (int t = first_thread; t < num_threads; t++)
+    {
+        if (jobs[t].errorcode)
+        {
+            *errorcode = jobs[t].errorcode;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int kalman_scan_filter(const kf6_t *kf, const kalman_tuning_t *tuning, const flight_log_t *log,
+                       int num_threads, real_t *x_out, real_t *P_out, int *errorcode)
+{
+    int num_steps = log->num_steps;
+    if (num_steps <= 0)
+        return 1;
+    if (num_threads < 1)
+        num_threads = 1;
+    if (num_threads > num_steps)
+        num_threads = num_steps;
+
+    kalman_scan_element_t *elements = malloc((size_t)num_steps * sizeof(kalman_scan_element_t));
+    scan_job_t jobs[num_threads];
+    if (elements == NULL)
+    {
+        fprintf(stderr, "kalman_scan: could not allocate %d elements\n", num_steps);
+        return 0;
+    }
+
+    for (int t = 0; t < num_threads; t++)
+    {
+        jobs[t].kf = kf;
+        jobs[t].tuning = tuning;
+        jobs[t].log = log;
+        jobs[t].elements = elements;
+        jobs[t].begin = (int)((long)num_steps * t / num_threads);
+        jobs[t].end = (int)((long)num_steps * (t + 1) / num_threads);
+        jobs[t].errorcode = 0;
+    }
+
+    int ok = run_phase(jobs, 0, num_threads, scan_block, errorcode);
+
+    // phase 2: carry the block totals forward sequentially
+    for (int t = 1; ok && t < num_threads; t++)
+    {
+        ok = combine(&elements[jobs[t - 1].end - 1], &elements[jobs[t].end - 1],
+                     &elements[jobs[t].end - 1], errorcode);
+    }
+
+    if (ok)
+        ok = run_phase(jobs, 1, num_threads, apply_prefix, errorcode);
+
+    for (int k = 0; ok && k < num_steps; k++)
+    {
+        for (int i = 0; i < NX; i++)
+            x_out[k * NX + i] = elements[k].b[i];
+        if (P_out != NULL)
+        {
+            for (int i = 0; i < NX * NX; i++)
+                P_out[(long)k * NX * NX + i] = elements[k].C[i];
+        }
+    }
+
+    free(elements);
+    return ok;
+}
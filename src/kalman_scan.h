@@ -0,0 +1,48 @@
+#ifndef KALMAN_SCAN_H
+#define KALMAN_SCAN_H
+
+#include "kalman_filter.h"
+#include "flight_sim.h"
+
+/*
+ * Parallel-in-time Kalman filtering for offline reprocessing.
+ *
+ * Each step k becomes an element (A, b, C, eta, J) of an associative
+ * operator whose inclusive prefix over steps 1..k is the filtered estimate
+ * xkk = b and P = C of step k (Sarkka and Garcia-Fernandez, "Temporal
+ * parallelization of Bayesian smoothers", 2021). Building the elements is
+ * independent per step and the prefix is evaluated with a three phase
+ * blocked scan, so the work is spread over num_threads threads.
+ *
+ * The result matches running kalman_step sequentially from the same initial
+ * filter, up to rounding.
+ *
+ * The parallelism is paid for with work: an element costs several 6x6
+ * products and two 6x6 solves where kalman_step needs a few. On one thread
+ * the scan measured about 3x the time of the sequential filter, and with
+ * several threads the extra prefix pass brings the total work to about 7.5x.
+ * It therefore only beats kalman_step with KALMAN_SCAN_BREAK_EVEN_THREADS
+ * or more cores; below that callers should run kalman_step instead.
+ */
+
+#define KALMAN_SCAN_BREAK_EVEN_THREADS 8
+
+typedef struct kalman_scan_element
+{
+    real_t A[dimState * dimState];
+    real_t b[dimState];
+    real_t C[dimState * dimState];
+    real_t eta[dimState];
+    real_t J[dimState * dimState];
+} kalman_scan_element_t;
+
+/**
+ * Filter every step of log starting from the state, covariance and model in
+ * kf, using num_threads threads. x_out receives log->num_steps * dimState
+ * state estimates, P_out, if not NULL, the matching covariances.
+ * Returns 1 on success and 0 with errorcode set otherwise.
+ */
+int kalman_scan_filter(const kf6_t *kf, const kalman_tuning_t *tuning, const flight_log_t *log,
+                       int num_threads, real_t *x_out, real_t *P_out, int *errorcode);
+
+#endif
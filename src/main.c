@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include "kalman_config.h"
+#include "kalman_filter.h"
+#include "math_util.h"
+
+static void smoke_checks()
+{
+    // test that matmul works: R*H
+    matrix_t result;
+    result.numRow = R.numRow;
+    result.numCol = H.numCol;
+    real_t resultData[numRowR * numColH] = {0};
+    int errcode = 0;
+    result.data = resultData;
+    if (!matmul(&R, &H, &result, &errcode))
+    {
+        printf("matrix multiplication failed");
+    }
+
+    printf("R matrix\n");
+    pprint_matrix(&R);
+
+    printf("H matrix\n");
+    pprint_matrix(&H);
+
+    printf("result matrix RxH\n");
+    pprint_matrix(&result);
+    printf("\n");
+
+    result.numCol = B.numCol;
+    clear_matrix(&result);
+    errcode = 0;
+    matmul(&H, &B, &result, &errcode);
+    printf("B matrix\n");
+    pprint_matrix(&B);
+    printf("H x B\n");
+    pprint_matrix(&result);
+}
+
+int main()
+{
+    kalman_filter_init();
+    printf("hello kalman!\n");
+
+    smoke_checks();
+}
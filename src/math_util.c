@@ -1,8 +1,9 @@
 #include <stdio.h>
+#include <math.h>
 #include "math_util.h"
 
 // https://www.andreinc.net/2021/01/20/writing-your-own-linear-algebra-matrix-library-in-c#retrieving--selecting-a-column
-void set_val(matrix_t *m, int row, int col, float value)
+void set_val(matrix_t *m, int row, int col, real_t value)
 {
     int numCol, idx;
     numCol = m->numCol;
@@ -10,7 +11,7 @@ void set_val(matrix_t *m, int row, int col, float value)
     m->data[idx] = value;
 }
 
-float get_value(matrix_t *m, int row, int col)
+real_t get_value(matrix_t *m, int row, int col)
 {
     int numCol, idx;
     numCol = m->numCol;
@@ -28,7 +29,7 @@ void pprint_matrix(matrix_t *A)
         printf("|");
         for (j = 0; j < M; j++)
         {
-            printf(" %8.4f", get_value(A, i, j));
+            printf(" %8.4f", (double)real_to_float(get_value(A, i, j)));
         }
         printf(" |\n");
     }
@@ -44,8 +45,8 @@ int copy_matrix(matrix_t *matA, matrix_t *matB)
         return 0;
     }
 
-    float *A = matA->data;
-    float *B = matB->data;
+    real_t *A = matA->data;
+    real_t *B = matB->data;
     for (int j = 0; j < N * M; j++)
     {
         B[j] = A[j];
@@ -56,10 +57,10 @@ int copy_matrix(matrix_t *matA, matrix_t *matB)
 void clear_matrix(matrix_t *mat)
 {
     int N = mat->numRow, M = mat->numCol;
-    float *m = mat->data;
+    real_t *m = mat->data;
     for (int j = 0; j < N * M; j++)
     {
-        m[j] = 0.0f;
+        m[j] = 0;
     }
 }
 
@@ -149,29 +150,104 @@ int vecadd(vector_t *a, vector_t *b, vector_t *output, int *errorcode)
  * the errorcode argument
  * It is the responsibility of the caller to check this
  *
+ * Products with a dimension below MATMUL_BLOCKED_MIN, such as the filter's
+ * 6x6 and 6x3 matrices and matrix-vector products, use a plain row-major
+ * kernel, all others go through matmul_blocked.
  */
 int matmul(matrix_t *left, matrix_t *right, matrix_t *result, int *errorcode)
 {
 
-    if (!(left->numCol == right->numRow))
+    if (!(left->numCol == right->numRow &&
+          result->numRow == left->numRow && result->numCol == right->numCol))
     {
-        fprintf(stderr, "matrix multiplications mismatch with shapes (%dx%d) * (%dx%d), errorcode %d\n",
-                left->numRow, left->numCol, right->numRow, right->numCol, MATMUL_DIMENSION_MISMATCH_ERROR);
+        fprintf(stderr, "matrix multiplications mismatch with shapes (%dx%d) * (%dx%d) = (%dx%d), errorcode %d\n",
+                left->numRow, left->numCol, right->numRow, right->numCol,
+                result->numRow, result->numCol, MATMUL_DIMENSION_MISMATCH_ERROR);
         *errorcode = MATMUL_DIMENSION_MISMATCH_ERROR;
         return 0;
     }
 
-    float res;
-    for (int row = 0; row < result->numRow; row++)
+    int numRow = left->numRow, inner = left->numCol, numCol = right->numCol;
+    if (numRow >= MATMUL_BLOCKED_MIN && inner >= MATMUL_BLOCKED_MIN && numCol >= MATMUL_BLOCKED_MIN)
+        return matmul_blocked(left, right, result, errorcode);
+
+    // row, inner index, then col: the innermost loop walks a row of
+    // right and a row of result contiguously
+    real_t *a = left->data, *b = right->data, *c = result->data;
+    for (int row = 0; row < numRow; row++)
     {
-        for (int col = 0; col < result->numCol; col++)
+        real_t *c_row = &c[row * numCol];
+        for (int col = 0; col < numCol; col++)
+            c_row[col] = 0;
+        for (int i = 0; i < inner; i++)
         {
-            res = 0.0f;
-            for (int i = 0; i < left->numRow; i++)
+            real_t a_ri = a[row * inner + i];
+            real_t *b_row = &b[i * numCol];
+            for (int col = 0; col < numCol; col++)
+                c_row[col] += real_mul(a_ri, b_row[col]);
+        }
+    }
+    return 1;
+}
+
+/**
+ * Multiply left and right matrices in MATMUL_BLOCK_SIZE tiles
+ *
+ * Each tile of right is packed into a contiguous buffer, zero padded to the
+ * full tile width, and reused for every row of left. MATMUL_ROWS rows of the
+ * result tile are accumulated in a local buffer, so the innermost loop has a
+ * constant trip count over contiguous, unaliased data and vectorizes, and
+ * every load of the packed tile is used MATMUL_ROWS times. Same contract as
+ * matmul.
+ */
+int matmul_blocked(matrix_t *left, matrix_t *right, matrix_t *result, int *errorcode)
+{
+    if (!(left->numCol == right->numRow &&
+          result->numRow == left->numRow && result->numCol == right->numCol))
+    {
+        fprintf(stderr, "matrix multiplications mismatch with shapes (%dx%d) * (%dx%d) = (%dx%d), errorcode %d\n",
+                left->numRow, left->numCol, right->numRow, right->numCol,
+                result->numRow, result->numCol, MATMUL_DIMENSION_MISMATCH_ERROR);
+        *errorcode = MATMUL_DIMENSION_MISMATCH_ERROR;
+        return 0;
+    }
+
+    int numRow = left->numRow, inner = left->numCol, numCol = right->numCol;
+    real_t *a = left->data, *b = right->data, *c = result->data;
+    real_t packed[MATMUL_BLOCK_SIZE * MATMUL_BLOCK_SIZE];
+
+    clear_matrix(result);
+    for (int jj = 0; jj < numCol; jj += MATMUL_BLOCK_SIZE)
+    {
+        int jb = numCol - jj < MATMUL_BLOCK_SIZE ? numCol - jj : MATMUL_BLOCK_SIZE;
+        for (int kk = 0; kk < inner; kk += MATMUL_BLOCK_SIZE)
+        {
+            int kb = inner - kk < MATMUL_BLOCK_SIZE ? inner - kk : MATMUL_BLOCK_SIZE;
+
+            // pack the kb x jb tile of right with row stride MATMUL_BLOCK_SIZE
+            for (int k = 0; k < kb; k++)
+                for (int j = 0; j < MATMUL_BLOCK_SIZE; j++)
+                    packed[k * MATMUL_BLOCK_SIZE + j] = j < jb ? b[(kk + k) * numCol + jj + j] : 0;
+
+            for (int row = 0; row < numRow; row += MATMUL_ROWS)
             {
-                res += get_value(left, row, i) * get_value(right, i, col);
+                int rb = numRow - row < MATMUL_ROWS ? numRow - row : MATMUL_ROWS;
+                real_t acc[MATMUL_ROWS][MATMUL_BLOCK_SIZE] = {{0}};
+                for (int k = 0; k < kb; k++)
+                {
+                    const real_t *p_row = &packed[k * MATMUL_BLOCK_SIZE];
+                    for (int r = 0; r < MATMUL_ROWS; r++)
+                    {
+                        // rows past the end multiply by zero
+                        real_t a_rk = r < rb ? a[(row + r) * inner + kk + k] : 0;
+                        for (int j = 0; j < MATMUL_BLOCK_SIZE; j++)
+                            acc[r][j] += real_mul(a_rk, p_row[j]);
+                    }
+                }
+                for (int r = 0; r < rb; r++)
+                    for (int j = 0; j < jb; j++)
+                        c[(row + r) * numCol + jj + j] += acc[r][j];
             }
-            set_val(result, row, col, res);
         }
     }
     return 1;
@@ -192,16 +268,11 @@ int matadd(matrix_t *a, matrix_t *b, matrix_t *result, int *errorcode)
         return 0;
     }
 
-    int row, col;
-    float a_rc, b_rc;
-    for (row = 0; row < numRow; row++)
+    // all three matrices are contiguous row-major with equal shapes
+    real_t *a_data = a->data, *b_data = b->data, *r_data = result->data;
+    for (int j = 0; j < numRow * numCol; j++)
     {
-        for (col = 0; col < numCol; col++)
-        {
-            a_rc = get_value(a, row, col);
-            b_rc = get_value(b, row, col);
-            set_val(result, row, col, a_rc + b_rc);
-        }
+        r_data[j] = a_data[j] + b_data[j];
     }
     return 1;
 }
@@ -221,16 +292,10 @@ int matsub(matrix_t *a, matrix_t *b, matrix_t *result, int *errorcode)
         return 0;
     }
 
-    int row, col;
-    float a_rc, b_rc;
-    for (row = 0; row < numRow; row++)
+    real_t *a_data = a->data, *b_data = b->data, *r_data = result->data;
+    for (int j = 0; j < numRow * numCol; j++)
     {
-        for (col = 0; col < numCol; col++)
-        {
-            a_rc = get_value(a, row, col);
-            b_rc = get_value(b, row, col);
-            set_val(result, row, col, a_rc - b_rc);
-        }
+        r_data[j] = a_data[j] - b_data[j];
     }
     return 1;
 }
@@ -240,7 +305,7 @@ int matsub(matrix_t *a, matrix_t *b, matrix_t *result, int *errorcode)
  */
 void swaprows_inplace(matrix_t *m, int i, int j)
 {
-    float elem_i, elem_j;
+    real_t elem_i, elem_j;
     for (int col = 0; col < m->numCol; col++)
     {
         elem_i = get_value(m, i, col);
@@ -255,7 +320,7 @@ void swaprows_inplace(matrix_t *m, int i, int j)
  */
 void swapcols_inplace(matrix_t *m, int i, int j)
 {
-    float elem_i, elem_j;
+    real_t elem_i, elem_j;
     for (int row = 0; row < m->numRow; row++)
     {
         elem_i = get_value(m, row, i);
@@ -265,13 +330,13 @@ void swapcols_inplace(matrix_t *m, int i, int j)
     }
 }
 
-void mult_mat_scal(matrix_t *mat, float scalar)
+void mult_mat_scal(matrix_t *mat, real_t scalar)
 {
     int N = mat->numRow, M = mat->numCol;
-    float *m = mat->data;
+    real_t *m = mat->data;
     for (int j = 0; j < N * M; j++)
     {
-        m[j] = m[j] * scalar;
+        m[j] = real_mul(m[j], scalar);
     }
 }
 
@@ -288,29 +353,44 @@ int inv3x3(matrix_t *A, matrix_t *invA, int *errorcode)
         return 0;
     }
 
-    float a11, a12, a13, a21, a22, a23, a31, a32, a33; // matrix elements
-    float m11, m12, m13, m21, m22, m23, m31, m32, m33; // minors
-    float c11, c12, c13, c21, c22, c23, c31, c32, c33; // cofactors
-    float det3x3;
+    real_t a11, a12, a13, a21, a22, a23, a31, a32, a33; // matrix elements
+    real_t m11, m12, m13, m21, m22, m23, m31, m32, m33; // minors
+    real_t c11, c12, c13, c21, c22, c23, c31, c32, c33; // cofactors
+    real_t det3x3;
     // clang-format off
     a11 = get_value(A, 0, 0); a12 = get_value(A, 0, 1); a13 = get_value(A, 0, 2);
     a21 = get_value(A, 1, 0); a22 = get_value(A, 1, 1); a23 = get_value(A, 1, 2);
     a31 = get_value(A, 2, 0); a32 = get_value(A, 2, 1); a33 = get_value(A, 2, 2);
 
     // minors
-    m11 = a22*a33 - a23*a23; m12 = a21*a33 - a31*a23; m13 = a21*a32 - a31*a22;
-    m21 = a12*a33 - a32*a13; m22 = a11*a33 - a31*a13; m23 = a11*a32 - a31*a12; 
-    m31 = a12*a23 - a22*a13; m32 = a11*a23 - a21*a13; m33 = a11*a22 - a21*a12;
+    m11 = real_mul(a22, a33) - real_mul(a32, a23);
+    m12 = real_mul(a21, a33) - real_mul(a31, a23);
+    m13 = real_mul(a21, a32) - real_mul(a31, a22);
+    m21 = real_mul(a12, a33) - real_mul(a32, a13);
+    m22 = real_mul(a11, a33) - real_mul(a31, a13);
+    m23 = real_mul(a11, a32) - real_mul(a31, a12);
+    m31 = real_mul(a12, a23) - real_mul(a22, a13);
+    m32 = real_mul(a11, a23) - real_mul(a21, a13);
+    m33 = real_mul(a11, a22) - real_mul(a21, a12);
 
     // cofactor c_ij = (-1)^(i + j)*m_ij
-    c11 =      m11, c12 = (-1)*m12, c13 =      m13;
-    c21 = (-1)*m21, c22 =      m22, c23 = (-1)*m23;
-    c31 =      m31, c32 = (-1)*m32, c33 =      m33;
+    c11 =  m11, c12 = -m12, c13 =  m13;
+    c21 = -m21, c22 =  m22, c23 = -m23;
+    c31 =  m31, c32 = -m32, c33 =  m33;
 
-    det3x3 = a11 * c11 + a12 * c12 + a13 * c13;
-    printf("detA = %f\n", det3x3);
+    det3x3 = real_mul(a11, c11) + real_mul(a12, c12) + real_mul(a13, c13);
 
-    if (det3x3 < 1E-5)
+    // |det| <= product of the row norms (Hadamard), the ratio does not
+    // depend on the scale of A; in double so fixed point cannot overflow
+    double row_norms = 1.0;
+    for (int row = 0; row < 3; row++)
+    {
+        double norm = 0.0;
+        for (int col = 0; col < 3; col++)
+            norm += fabs((double)real_to_float(get_value(A, row, col)));
+        row_norms *= norm;
+    }
+    if (det3x3 == 0 || fabs((double)real_to_float(det3x3)) < MAT_INV_RELATIVE_TOL * row_norms)
     {
         // noninvertible matrix!
         fprintf(stderr, "Error: taking inverse of non-invertible matrix!");
@@ -324,6 +404,110 @@ int inv3x3(matrix_t *A, matrix_t *invA, int *errorcode)
     set_val(invA, 2, 0, c13); set_val(invA, 2, 1, c23); set_val(invA, 2, 2, c33);
     // clang-format on
 
-    mult_mat_scal(invA, 1 / det3x3);
+    // divide each element rather than scale by 1 / det, which would lose
+    // the precision of a large determinant in fixed point
+    for (int j = 0; j < 9; j++)
+        invA->data[j] = real_div(invA->data[j], det3x3);
     return 1;
-}
\ No newline at end of file
+}
+
+/**
+ * take inverse of a square matrix A using Gauss-Jordan elimination with
+ * partial pivoting. A is copied to a scratch buffer so it is left unchanged.
+ */
+int matinv(matrix_t *A, matrix_t *invA, int *errorcode)
+{
+    int n = A->numRow;
+    if (!(A->numCol == n && invA->numRow == n && invA->numCol == n))
+    {
+        fprintf(stderr, "shapes of matrix A and invA must both be square and equal\n");
+        *errorcode = MAT_INV_SHAPE_MISMATCH_ERROR;
+        return 0;
+    }
+
+    stackMatrixAllocate(work, n, n);
+    copy_matrix(A, &work);
+
+    // largest element of every column, the pivot threshold scales with it
+    real_t column_max[n];
+    for (int col = 0; col < n; col++)
+    {
+        column_max[col] = 0;
+        for (int row = 0; row < n; row++)
+        {
+            if (real_abs(get_value(A, row, col)) > column_max[col])
+                column_max[col] = real_abs(get_value(A, row, col));
+        }
+    }
+    clear_matrix(invA);
+    for (int i = 0; i < n; i++)
+        set_val(invA, i, i, real_from_float(1.0f));
+
+    for (int col = 0; col < n; col++)
+    {
+        // pick the largest remaining element in this column as pivot
+        int pivot = col;
+        for (int row = col + 1; row < n; row++)
+        {
+            if (real_abs(get_value(&work, row, col)) > real_abs(get_value(&work, pivot, col)))
+                pivot = row;
+        }
+        // the threshold can round to 0 in fixed point, so test for 0 as well
+        real_t largest = real_abs(get_value(&work, pivot, col));
+        if (largest == 0 ||
+            (double)real_to_float(largest) < MAT_INV_RELATIVE_TOL * (double)real_to_float(column_max[col]))
+        {
+            fprintf(stderr, "Error: taking inverse of non-invertible matrix!");
+            *errorcode = MAT_INV_SINGULAR_MATRIX_ERROR;
+            return 0;
+        }
+        if (pivot != col)
+        {
+            swaprows_inplace(&work, pivot, col);
+            swaprows_inplace(invA, pivot, col);
+        }
+
+        real_t pivot_value = get_value(&work, col, col);
+        for (int j = 0; j < n; j++)
+        {
+            set_val(&work, col, j, real_div(get_value(&work, col, j), pivot_value));
+            set_val(invA, col, j, real_div(get_value(invA, col, j), pivot_value));
+        }
+
+        for (int row = 0; row < n; row++)
+        {
+            real_t factor = get_value(&work, row, col);
+            if (row == col || factor == 0)
+                continue;
+            for (int j = 0; j < n; j++)
+            {
+                set_val(&work, row, j, get_value(&work, row, j) - real_mul(factor, get_value(&work, col, j)));
+                set_val(invA, row, j, get_value(invA, row, j) - real_mul(factor, get_value(invA, col, j)));
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * store the transpose of A in At
+ */
+int transpose(matrix_t *A, matrix_t *At, int *errorcode)
+{
+    if (!(A->numRow == At->numCol && A->numCol == At->numRow))
+    {
+        fprintf(stderr, "transpose shape mismatch (%dx%d) -> (%dx%d), errorcode %d\n",
+                A->numRow, A->numCol, At->numRow, At->numCol, MATMUL_DIMENSION_MISMATCH_ERROR);
+        *errorcode = MATMUL_DIMENSION_MISMATCH_ERROR;
+        return 0;
+    }
+
+    for (int row = 0; row < A->numRow; row++)
+    {
+        for (int col = 0; col < A->numCol; col++)
+        {
+            set_val(At, col, row, get_value(A, row, col));
+        }
+    }
+    return 1;
+}
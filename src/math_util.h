@@ -1,20 +1,106 @@
+#ifndef MATH_UTIL_H
+#define MATH_UTIL_H
+
+#include <stdint.h>
+#include <math.h>
+
+/*
+ * Scalar type real_t of matrix_t, vector_t and every routine below, chosen
+ * at build time:
+ *
+ *   default              float
+ *   -DMATH_UTIL_DOUBLE   double, for offline reference runs
+ *   -DMATH_UTIL_FIXED    signed Q15.16 fixed point in an int32_t, products
+ *                        and quotients go through int64_t
+ *
+ * Code that must work with every backend converts constants and inputs with
+ * real_from_float, reads results with real_to_float and multiplies and
+ * divides with real_mul and real_div.
+ */
+#if defined(MATH_UTIL_FIXED)
+
+#define REAL_FRAC_BITS 16
+#define REAL_BACKEND_NAME "fixed Q15.16"
+typedef int32_t real_t;
+
+static inline real_t real_from_float(float value)
+{
+    return (real_t)lrintf(value * (float)(1 << REAL_FRAC_BITS));
+}
+static inline float real_to_float(real_t value) { return (float)value / (float)(1 << REAL_FRAC_BITS); }
+static inline real_t real_mul(real_t a, real_t b)
+{
+    // round to nearest
+    return (real_t)(((int64_t)a * b + (1 << (REAL_FRAC_BITS - 1))) >> REAL_FRAC_BITS);
+}
+static inline real_t real_div(real_t a, real_t b) { return (real_t)(((int64_t)a << REAL_FRAC_BITS) / b); }
+static inline real_t real_abs(real_t a) { return a < 0 ? -a : a; }
+
+#elif defined(MATH_UTIL_DOUBLE)
+
+#define REAL_BACKEND_NAME "double"
+typedef double real_t;
+
+static inline real_t real_from_float(float value) { return value; }
+static inline float real_to_float(real_t value) { return (float)value; }
+static inline real_t real_mul(real_t a, real_t b) { return a * b; }
+static inline real_t real_div(real_t a, real_t b) { return a / b; }
+static inline real_t real_abs(real_t a) { return fabs(a); }
+
+#else
+
+#define REAL_BACKEND_NAME "float"
+typedef float real_t;
+
+static inline real_t real_from_float(float value) { return value; }
+static inline float real_to_float(real_t value) { return value; }
+static inline real_t real_mul(real_t a, real_t b) { return a * b; }
+static inline real_t real_div(real_t a, real_t b) { return a / b; }
+static inline real_t real_abs(real_t a) { return fabsf(a); }
+
+#endif
+
+// inv3x3 and matinv treat a matrix as singular below this relative size of
+// the determinant or pivot, see there; independent of the matrix scale so
+// covariances of very precise sensors still invert
+#ifdef MATH_UTIL_DOUBLE
+#define MAT_INV_RELATIVE_TOL 1e-14
+#else
+#define MAT_INV_RELATIVE_TOL 1e-6
+#endif
 
 #define MATMUL_DIMENSION_MISMATCH_ERROR 1
 #define MATADD_DIMENSION_MISMATCH_ERROR 2
 #define MAT_INV_SINGULAR_MATRIX_ERROR 3
 #define MAT_INV_SHAPE_MISMATCH_ERROR 4
 
+// tile edge used by matmul_blocked, 32x32 float elements = 4 KiB per packed tile
+#ifndef MATMUL_BLOCK_SIZE
+#define MATMUL_BLOCK_SIZE 32
+#endif
+
+// rows of the result accumulated together by matmul_blocked
+#ifndef MATMUL_ROWS
+#define MATMUL_ROWS 4
+#endif
+
+// matmul switches to matmul_blocked once every dimension reaches this,
+// below it the zero padding of the tiles costs more than blocking saves
+#ifndef MATMUL_BLOCKED_MIN
+#define MATMUL_BLOCKED_MIN 16
+#endif
+
 typedef struct matrix
 {
     int numCol;
     int numRow;
-    float *data;
+    real_t *data;
 } matrix_t;
 
 typedef struct vector
 {
     int dim;
-    float *data;
+    real_t *data;
 } vector_t;
 
 
@@ -25,24 +111,36 @@ typedef struct vector
 #define GENERATE_VAR(prefix, name) prefix ## _ ## name
 
 /**
- * Allocate a vector_t vectorname with dimension dim=dim and its data float[dim] statically
+ * Allocate a vector_t vectorname with dimension dim=dim and its data real_t[dim] statically
  */
-#define stackVectorAllocate(name, dim) \
-    float GENERATE_VAR(name, data)[dim]; \
+#define stackVectorAllocate(name, size) \
+    real_t GENERATE_VAR(name, data)[(size)]; \
     vector_t name; \
+    (name).dim = (size); \
     (name).data = GENERATE_VAR(name, data);
 
-#define stackMatrixAllocate(name, numRow, numCol) \
-    float GENERATE_VAR(name, data)[numRow * numCol]; \
+#define stackMatrixAllocate(name, rows, cols) \
+    real_t GENERATE_VAR(name, data)[(rows) * (cols)]; \
     matrix_t name; \
+    (name).numRow = (rows); \
+    (name).numCol = (cols); \
     (name).data = GENERATE_VAR(name, data);
 
+/**
+ * Wrap existing row-major storage of shape rows x cols in a matrix_t called name
+ */
+#define matrixView(name, ptr, rows, cols) \
+    matrix_t name; \
+    (name).numRow = (rows); \
+    (name).numCol = (cols); \
+    (name).data = (ptr);
+
 /** Pretty print a matrix A */
 void pprint_matrix(matrix_t *A);
 
-void set_val(matrix_t *m, int row, int col, float value);
+void set_val(matrix_t *m, int row, int col, real_t value);
 
-float get_value(matrix_t *m, int row, int col);
+real_t get_value(matrix_t *m, int row, int col);
 
 /**
  * Multiply left and right matrices
@@ -51,11 +149,18 @@ float get_value(matrix_t *m, int row, int col);
  * Mismatching dimensions leaves all matrices as is and sets and error code in
  * the errorcode argument
  * It is the responsibility of the caller to check this
+ * result must not share storage with left or right
  * 
  */
 int matmul(matrix_t *left, matrix_t *right, matrix_t *result, int *errorcode);
 
-void mult_mat_scal(matrix_t *mat, float scalar);
+/**
+ * Cache-blocked matmul with packed tiles of right, same contract as matmul.
+ * matmul calls this itself once every dimension reaches MATMUL_BLOCKED_MIN.
+ */
+int matmul_blocked(matrix_t *left, matrix_t *right, matrix_t *result, int *errorcode);
+
+void mult_mat_scal(matrix_t *mat, real_t scalar);
 
 int matsub(matrix_t *a, matrix_t *b, matrix_t *result, int *errorcode);
 int matadd(matrix_t *a, matrix_t *b, matrix_t *result, int *errorcode);
@@ -82,6 +187,23 @@ void swapcols_inplace(matrix_t *m, int i, int j);
 
 
 /**
- * take inverse of 3x3 matrix A and store it in matrix invA
+ * take inverse of 3x3 matrix A and store it in matrix invA. A is singular if
+ * |det(A)| is below MAT_INV_RELATIVE_TOL times the product of its row norms,
+ * an upper bound of |det(A)|, so scaling A does not change the outcome.
  */
-int inv3x3(matrix_t *A, matrix_t *invA, int *errorcode);
\ No newline at end of file
+int inv3x3(matrix_t *A, matrix_t *invA, int *errorcode);
+
+/**
+ * take inverse of a square matrix A of any size using Gauss-Jordan elimination
+ * with partial pivoting and store it in matrix invA. A is left unchanged.
+ * A is singular if a pivot is below MAT_INV_RELATIVE_TOL times the largest
+ * element of its column in A.
+ */
+int matinv(matrix_t *A, matrix_t *invA, int *errorcode);
+
+/**
+ * store the transpose of A in At
+ */
+int transpose(matrix_t *A, matrix_t *At, int *errorcode);
+
+#endif
@@ -0,0 +1,551 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "kalman_filter.h"
+#include "sensor_handlers.h"
+#include "flight_sim.h"
+
+/*
+ * Accuracy and performance regression gate, run by make check.
+ *
+ * Runs the production filter, both kalman_step and kalman_step_information,
+ * and a straightforward double precision reference filter over fixed
+ * synthetic flights, one of them with a precise 3-D position sensor. Fails
+ * if an estimate of either path leaves its tolerance around the reference.
+ *
+ * Also fails if kalman_step got slower than the baseline file allows. The
+ * baseline is the ns/iteration of kalman_step over that of the reference
+ * filter, timed interleaved in the same run: machine load slows both alike,
+ * so the ratio moves by about 10 % between runs where the ns/iteration moves
+ * by 30 % and more. -w rewrites the baseline with the median of several
+ * rounds, e.g. after an intended change or on a machine where the ratio
+ * differs. The file names the backend it was measured with and a baseline of
+ * another backend is rejected.
+ *
+ * usage: regression [-b baseline_file] [-w] [-v]
+ * exit status 0 when every check passes
+ */
+
+#define NX dimState
+#define NZ numRowH
+#define NU numColB
+
+#define REGRESSION_STEPS 3000
+#define REGRESSION_TIMING_REPEATS 20
+
+// the ratio depends on the backend, so each has its own baseline file; make
+// check passes the one of $(BACKEND) with -b
+#ifdef MATH_UTIL_DOUBLE
+#define REGRESSION_BASELINE_FILE "regression_baseline.double.txt"
+#else
+#define REGRESSION_BASELINE_FILE "regression_baseline.float.txt"
+#endif
+
+// -w writes the median ratio of this many timing rounds
+#define REGRESSION_BASELINE_ROUNDS 7
+
+// allowed growth of the ratio over the baseline, 20 %; one round scatters
+// about 10 % around the median
+#define REGRESSION_BASELINE_SLACK 1.2
+
+// largest allowed |production - reference| in m and m/s per path, two to
+// three times the largest deviation over the scenarios. The float build
+// loses about three digits to the cancellation in P = (Id - K * H) * P, the
+// information path about as many to its solve with Id + P_pred * Y; the
+// double build still gets Q and R from float arithmetic in kalman_filter.c
+#ifdef MATH_UTIL_DOUBLE
+#define REGRESSION_STEP_POS_TOL 1e-6
+#define REGRESSION_STEP_VEL_TOL 1e-6
+#define REGRESSION_INFO_POS_TOL 1e-6
+#define REGRESSION_INFO_VEL_TOL 1e-6
+#else
+#define REGRESSION_STEP_POS_TOL 5e-3
+#define REGRESSION_STEP_VEL_TOL 5e-3
+#define REGRESSION_INFO_POS_TOL 5e-3
+#define REGRESSION_INFO_VEL_TOL 1.5e-2
+#endif
+
+// r_gain of the precise sensor scenario, R = diag(1e-3, 1e-3, ~0.2) has a
+// determinant around 1e-7 that an absolute singularity test rejects
+#define REGRESSION_PRECISE_R_GAIN 0.01f
+
+typedef struct scenario
+{
+    unsigned long seed;
+    float r_gain;  // replaces the tuning default when not 0
+    int sensor_3d; // information path gets one 3-D position sensor instead of GNSS + barometer
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    {1, 0.0f, 0},
+    {7, 0.0f, 0},
+    {42, 0.0f, 0},
+    {2024, 0.0f, 0},
+    {99, REGRESSION_PRECISE_R_GAIN, 1},
+};
+#define NUM_SCENARIOS (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// reference filter, the textbook equations in double with no shortcuts
+typedef struct reference_filter
+{
+    double x[NX], P[NX * NX];
+    double F[NX * NX], B[NX * NU], H[NZ * NX], Q[NX * NX], R[NZ * NZ];
+} reference_filter_t;
+
+static void ref_mul(const double *a, const double *b, double *c, int rows, int inner, int cols)
+{
+    for (int row = 0; row < rows; row++)
+    {
+        for (int col = 0; col < cols; col++)
+        {
+            double res = 0.0;
+            for (int i = 0; i < inner; i++)
+                res += a[row * inner + i] * b[i * cols + col];
+            c[row * cols + col] = res;
+        }
+    }
+}
+
+static void ref_transpose(const double *a, double *at, int rows, int cols)
+{
+    for (int row = 0; row < rows; row++)
+        for (int col = 0; col < cols; col++)
+            at[col * rows + row] = a[row * cols + col];
+}
+
+/** Gauss-Jordan elimination with partial pivoting, returns 0 if singular */
+static int ref_invert(const double *a, double *inv, int n)
+{
+    double m[NX * NX];
+    for (int i = 0; i < n * n; i++)
+    {
+        m[i] = a[i];
+        inv[i] = 0.0;
+    }
+    for (int i = 0; i < n; i++)
+        inv[i * n + i] = 1.0;
+
+    for (int col = 0; col < n; col++)
+    {
+        int pivot = col;
+        for (int row = col + 1; row < n; row++)
+        {
+            if (fabs(m[row * n + col]) > fabs(m[pivot * n + col]))
+                pivot = row;
+        }
+        if (m[pivot * n + col] == 0.0)
+            return 0;
+        for (int i = 0; i < n; i++)
+        {
+            double t = m[col * n + i];
+            m[col * n + i] = m[pivot * n + i];
+            m[pivot * n + i] = t;
+            t = inv[col * n + i];
+            inv[col * n + i] = inv[pivot * n + i];
+            inv[pivot * n + i] = t;
+        }
+        double d = m[col * n + col];
+        for (int i = 0; i < n; i++)
+        {
+            m[col * n + i] /= d;
+            inv[col * n + i] /= d;
+        }
+        for (int row = 0; row < n; row++)
+        {
+            if (row == col)
+                continue;
+            double f = m[row * n + col];
+            for (int i = 0; i < n; i++)
+            {
+                m[row * n + i] -= f * m[col * n + i];
+                inv[row * n + i] -= f * inv[col * n + i];
+            }
+        }
+    }
+    return 1;
+}
+
+// the model of kalman_model_init, written out again on its own
+static void reference_init(reference_filter_t *ref, const kalman_tuning_t *tuning)
+{
+    double dt = (double)Dt;
+    double sigma_q = (double)tuning->accel_variance * (double)tuning->q_gain;
+
+    for (int i = 0; i < NX; i++)
+        ref->x[i] = 0.0;
+    for (int i = 0; i < NX * NX; i++)
+        ref->P[i] = ref->F[i] = ref->Q[i] = 0.0;
+    for (int i = 0; i < NX * NU; i++)
+        ref->B[i] = 0.0;
+    for (int i = 0; i < NZ * NX; i++)
+        ref->H[i] = 0.0;
+    for (int i = 0; i < NZ * NZ; i++)
+        ref->R[i] = 0.0;
+
+    for (int i = 0; i < NX; i++)
+    {
+        ref->P[i * NX + i] = 1.0;
+        ref->F[i * NX + i] = 1.0;
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        ref->F[i * NX + i + 3] = dt;
+        ref->B[i * NU + i] = 0.5 * dt * dt;
+        ref->B[(i + 3) * NU + i] = dt;
+        ref->H[i * NX + i] = 1.0;
+        ref->Q[i * NX + i] = 0.25 * dt * dt * dt * dt * sigma_q;
+        ref->Q[(i + 3) * NX + i + 3] = dt * dt * sigma_q;
+        ref->Q[i * NX + i + 3] = ref->Q[(i + 3) * NX + i] = 0.5 * dt * dt * dt * sigma_q;
+    }
+}
+
+static int reference_step(reference_filter_t *ref, const kalman_tuning_t *tuning, const flight_step_t *step)
+{
+    double x_pred[NX], P_pred[NX * NX], Fref_t[NX * NX], Href_t[NX * NZ], tmp[NX * NX];
+    double Bu[NX], u[NU], y[NZ], Hx[NZ], PHt[NX * NZ], Sk[NZ * NZ], invSk[NZ * NZ];
+    double Kk[NX * NZ], KH[NX * NX], Ky[NX];
+
+    ref->R[0] = (double)tuning->gnss_x_variance * (double)tuning->r_gain;
+    ref->R[NZ + 1] = (double)tuning->gnss_y_variance * (double)tuning->r_gain;
+    ref->R[2 * NZ + 2] = (double)barometer_altitude_variance(step->pressure) * (double)tuning->r_gain;
+
+    // x_pred = F * x + B * u, P_pred = F * P * F.T + Q
+    for (int i = 0; i < NU; i++)
+        u[i] = (double)step->ak[i];
+    ref_mul(ref->F, ref->x, x_pred, NX, NX, 1);
+    ref_mul(ref->B, u, Bu, NX, NU, 1);
+    for (int i = 0; i < NX; i++)
+        x_pred[i] += Bu[i];
+    ref_transpose(ref->F, Fref_t, NX, NX);
+    ref_mul(ref->F, ref->P, tmp, NX, NX, NX);
+    ref_mul(tmp, Fref_t, P_pred, NX, NX, NX);
+    for (int i = 0; i < NX * NX; i++)
+        P_pred[i] += ref->Q[i];
+
+    // y = z - H * x_pred, Sk = H * P_pred * H.T + R, Kk = P_pred * H.T * inv(Sk)
+    ref_mul(ref->H, x_pred, Hx, NZ, NX, 1);
+    for (int i = 0; i < NZ; i++)
+        y[i] = (double)step->zk[i] - Hx[i];
+    ref_transpose(ref->H, Href_t, NZ, NX);
+    ref_mul(P_pred, Href_t, PHt, NX, NX, NZ);
+    ref_mul(ref->H, PHt, Sk, NZ, NX, NZ);
+    for (int i = 0; i < NZ * NZ; i++)
+        Sk[i] += ref->R[i];
+    if (!ref_invert(Sk, invSk, NZ))
+    {
+        fprintf(stderr, "regression: singular innovation covariance in the reference filter\n");
+        return 0;
+    }
+    ref_mul(PHt, invSk, Kk, NX, NZ, NZ);
+
+    // x = x_pred + Kk * y, P = (Id - Kk * H) * P_pred
+    ref_mul(Kk, y, Ky, NX, NZ, 1);
+    for (int i = 0; i < NX; i++)
+        ref->x[i] = x_pred[i] + Ky[i];
+    ref_mul(Kk, ref->H, KH, NX, NZ, NX);
+    for (int i = 0; i < NX * NX; i++)
+        KH[i] = -KH[i];
+    for (int i = 0; i < NX; i++)
+        KH[i * NX + i] += 1.0;
+    ref_mul(KH, P_pred, ref->P, NX, NX, NX);
+    return 1;
+}
+
+// the same update as kalman_step from one GNSS receiver and one barometer,
+// or with sensor_3d from a single sensor measuring all three positions
+static int information_step(kf6_t *kf, const kalman_tuning_t *tuning, const flight_step_t *step,
+                            int sensor_3d, int *errorcode)
+{
+    real_t gnss_R[4] = {0}, gnss_z[2], baro_R[1], baro_z[1];
+    gnss_R[0] = tuning->gnss_x_variance * tuning->r_gain;
+    gnss_R[3] = tuning->gnss_y_variance * tuning->r_gain;
+    gnss_z[0] = step->zk[0];
+    gnss_z[1] = step->zk[1];
+    baro_R[0] = barometer_altitude_variance(step->pressure) * tuning->r_gain;
+    baro_z[0] = step->zk[2];
+
+    if (sensor_3d)
+    {
+        real_t pos_R[NZ * NZ] = {0}, pos_z[NZ];
+        pos_R[0] = gnss_R[0];
+        pos_R[NZ + 1] = gnss_R[3];
+        pos_R[2 * NZ + 2] = baro_R[0];
+        for (int i = 0; i < NZ; i++)
+            pos_z[i] = step->zk[i];
+        kalman_sensor_t position = {NZ, kf->H, pos_R, pos_z};
+        return kalman_step_information(kf, step->ak, &position, 1, errorcode);
+    }
+
+    kalman_sensor_t sensors[2] = {{2, gnss_H, gnss_R, gnss_z}, {1, barometer_H, baro_R, baro_z}};
+    return kalman_step_information(kf, step->ak, sensors, 2, errorcode);
+}
+
+typedef struct deviation
+{
+    double pos, vel; // largest |production - reference| over the flight
+} deviation_t;
+
+static void accumulate_deviation(deviation_t *dev, const real_t *x, const double *x_ref)
+{
+    for (int i = 0; i < NX; i++)
+    {
+        double d = fabs((double)x[i] - x_ref[i]);
+        double *worst = i < 3 ? &dev->pos : &dev->vel;
+        if (d > *worst)
+            *worst = d;
+    }
+}
+
+/** run every filter over one flight, returns the number of failed checks */
+static int check_scenario(const flight_log_t *log, const kalman_tuning_t *tuning, const scenario_t *scenario,
+                          int verbose)
+{
+    unsigned long seed = scenario->seed;
+    kf6_t kf, kf_info;
+    reference_filter_t ref;
+    deviation_t dev = {0.0, 0.0}, dev_info = {0.0, 0.0};
+    int errorcode = 0;
+
+    kalman_model_init(&kf, tuning);
+    kalman_model_init(&kf_info, tuning);
+    reference_init(&ref, tuning);
+
+    for (int k = 0; k < log->num_steps; k++)
+    {
+        const flight_step_t *step = &log->steps[k];
+        if (!reference_step(&ref, tuning, step))
+            return 1;
+        if (!kalman_step(&kf, tuning, step->ak, step->zk, step->pressure, &errorcode) ||
+            !information_step(&kf_info, tuning, step, scenario->sensor_3d, &errorcode))
+        {
+            fprintf(stderr, "regression: seed %lu: filter failed at step %d, error %d\n", seed, k, errorcode);
+            return 1;
+        }
+        accumulate_deviation(&dev, kf.x, ref.x);
+        accumulate_deviation(&dev_info, kf_info.x, ref.x);
+    }
+
+    int failures = 0;
+    const char *names[2] = {"kalman_step", scenario->sensor_3d ? "kalman_step_information 3d" : "kalman_step_information"};
+    const deviation_t *devs[2] = {&dev, &dev_info};
+    const deviation_t tolerances[2] = {{REGRESSION_STEP_POS_TOL, REGRESSION_STEP_VEL_TOL},
+                                       {REGRESSION_INFO_POS_TOL, REGRESSION_INFO_VEL_TOL}};
+    for (int f = 0; f < 2; f++)
+    {
+        int ok = devs[f]->pos <= tolerances[f].pos && devs[f]->vel <= tolerances[f].vel;
+        if (!ok || verbose)
+        {
+            printf("%s seed %-5lu %-27s max |dx| pos %.3e m, vel %.3e m/s\n", ok ? "ok  " : "FAIL", seed,
+                   names[f], devs[f]->pos, devs[f]->vel);
+        }
+        failures += !ok;
+    }
+    return failures;
+}
+
+/** one run of the production filter over the flight, ns/iteration */
+static double time_production(const flight_log_t *log, const kalman_tuning_t *tuning)
+{
+    kf6_t kf;
+    int errorcode = 0;
+    kalman_model_init(&kf, tuning);
+    double start = now_seconds();
+    for (int k = 0; k < log->num_steps; k++)
+    {
+        const flight_step_t *step = &log->steps[k];
+        kalman_step(&kf, tuning, step->ak, step->zk, step->pressure, &errorcode);
+    }
+    double ns = (now_seconds() - start) * 1e9 / log->num_steps;
+    // keep the result alive so the loop is not optimized away
+    if (kf.x[0] != kf.x[0])
+        printf("nan\n");
+    return ns;
+}
+
+static double time_reference(const flight_log_t *log, const kalman_tuning_t *tuning)
+{
+    reference_filter_t ref;
+    reference_init(&ref, tuning);
+    double start = now_seconds();
+    for (int k = 0; k < log->num_steps; k++)
+        reference_step(&ref, tuning, &log->steps[k]);
+    double ns = (now_seconds() - start) * 1e9 / log->num_steps;
+    if (ref.x[0] != ref.x[0])
+        printf("nan\n");
+    return ns;
+}
+
+/**
+ * best of REGRESSION_TIMING_REPEATS runs of both filters, the runs
+ * alternate so a change in machine load hits both
+ */
+static void time_filters(const flight_log_t *log, const kalman_tuning_t *tuning, double *production_ns,
+                         double *reference_ns)
+{
+    for (int r = 0; r < REGRESSION_TIMING_REPEATS; r++)
+    {
+        double production = time_production(log, tuning);
+        double reference = time_reference(log, tuning);
+        if (r == 0 || production < *production_ns)
+            *production_ns = production;
+        if (r == 0 || reference < *reference_ns)
+            *reference_ns = reference;
+    }
+}
+
+/**
+ * read the ratio from a baseline file, returns 0 if there is none or it was
+ * measured with another backend
+ */
+static int read_baseline(const char *path, double *ratio)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+    char line[256], backend[256] = "";
+    int found = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        found |= sscanf(line, "ratio %lf", ratio) == 1;
+        if (strncmp(line, "backend ", 8) == 0)
+        {
+            snprintf(backend, sizeof(backend), "%s", line + 8);
+            backend[strcspn(backend, "\n")] = '\0';
+        }
+    }
+    fclose(file);
+    if (strcmp(backend, REAL_BACKEND_NAME) != 0)
+    {
+        fprintf(stderr, "regression: %s is a baseline of the %s backend, this is %s\n", path,
+                backend[0] ? backend : "unknown", REAL_BACKEND_NAME);
+        return 0;
+    }
+    return found && *ratio > 0.0;
+}
+
+static int write_baseline(const char *path, double ratio, double production_ns, double reference_ns)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        perror("regression: baseline");
+        return 0;
+    }
+    fprintf(file, "# ns/iteration of kalman_step over the reference filter in the same run,\n");
+    fprintf(file, "# median of %d rounds, written by ./regression -w\n", REGRESSION_BASELINE_ROUNDS);
+    fprintf(file, "# (last round %.1f ns against %.1f ns)\n", production_ns, reference_ns);
+    fprintf(file, "backend %s\n", REAL_BACKEND_NAME);
+    fprintf(file, "ratio %.3f\n", ratio);
+    if (fclose(file) != 0)
+    {
+        perror("regression: baseline");
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *baseline_path = REGRESSION_BASELINE_FILE;
+    int verbose = 0, write = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:wv")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            baseline_path = optarg;
+            break;
+        case 'w':
+            write = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-b baseline_file] [-w] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    kalman_tuning_t tuning;
+    kalman_default_tuning(&tuning);
+    int failures = 0;
+
+    printf("backend: %s\n", REAL_BACKEND_NAME);
+    for (int s = 0; s < NUM_SCENARIOS; s++)
+    {
+        kalman_tuning_t scenario_tuning = tuning;
+        if (scenarios[s].r_gain != 0.0f)
+            scenario_tuning.r_gain = scenarios[s].r_gain;
+        flight_log_t log;
+        if (!flight_sim_generate(&log, REGRESSION_STEPS, scenarios[s].seed))
+            return 1;
+        failures += check_scenario(&log, &scenario_tuning, &scenarios[s], verbose);
+        flight_log_free(&log);
+    }
+    printf("accuracy: %d scenarios, tolerance kalman_step %.0e m, %.0e m/s, information form %.0e m, %.0e m/s\n",
+           NUM_SCENARIOS, REGRESSION_STEP_POS_TOL, REGRESSION_STEP_VEL_TOL, REGRESSION_INFO_POS_TOL,
+           REGRESSION_INFO_VEL_TOL);
+
+    flight_log_t log;
+    if (!flight_sim_generate(&log, REGRESSION_STEPS, scenarios[0].seed))
+        return 1;
+    double production_ns = 0.0, reference_ns = 0.0;
+    time_filters(&log, &tuning, &production_ns, &reference_ns);
+    double ratio = production_ns / reference_ns;
+
+    if (write)
+    {
+        // insertion sort of the round ratios for the median
+        double ratios[REGRESSION_BASELINE_ROUNDS];
+        ratios[0] = ratio;
+        for (int r = 1; r < REGRESSION_BASELINE_ROUNDS; r++)
+        {
+            time_filters(&log, &tuning, &production_ns, &reference_ns);
+            double next = production_ns / reference_ns;
+            int i = r;
+            for (; i > 0 && ratios[i - 1] > next; i--)
+                ratios[i] = ratios[i - 1];
+            ratios[i] = next;
+        }
+        ratio = ratios[REGRESSION_BASELINE_ROUNDS / 2];
+        flight_log_free(&log);
+        if (!write_baseline(baseline_path, ratio, production_ns, reference_ns))
+            return 1;
+        printf("wrote %s: median ratio %.3f of %d rounds\n", baseline_path, ratio, REGRESSION_BASELINE_ROUNDS);
+    }
+    else
+    {
+        flight_log_free(&log);
+        double baseline_ratio = 0.0;
+        if (!read_baseline(baseline_path, &baseline_ratio))
+        {
+            printf("FAIL no baseline ratio in %s, create it with ./regression -w\n", baseline_path);
+            failures++;
+        }
+        else
+        {
+            int fast_enough = ratio <= REGRESSION_BASELINE_SLACK * baseline_ratio;
+            printf("%s production %.1f ns/iteration, reference %.1f ns/iteration, ratio %.3f, baseline %.3f, "
+                   "limit +%.0f %%\n",
+                   fast_enough ? "ok  " : "FAIL", production_ns, reference_ns, ratio, baseline_ratio,
+                   (REGRESSION_BASELINE_SLACK - 1.0) * 100.0);
+            failures += !fast_enough;
+        }
+    }
+
+    printf("%s\n", failures ? "regression check FAILED" : "regression check passed");
+    return failures ? 1 : 0;
+}
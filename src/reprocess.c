@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "kalman_filter.h"
+#include "kalman_scan.h"
+#include "flight_sim.h"
+
+/*
+ * Offline reprocessing of a whole flight: runs the sequential filter and the
+ * parallel-in-time scan over the same data, reports the time of both and the
+ * largest difference between their estimates. Exits with status 1 when that
+ * difference exceeds REPROCESS_TOLERANCE, so make check runs it as a test.
+ *
+ * Below KALMAN_SCAN_BREAK_EVEN_THREADS threads the scan is slower than the
+ * sequential filter, so only the sequential pass runs unless -f forces the
+ * scan as well.
+ *
+ * usage: reprocess [-f] [-j threads] [-n steps] [-s seed] [log.csv]
+ */
+
+#define REPROCESS_DEFAULT_STEPS 20000
+
+// largest allowed |x_scan - x_sequential| in m and m/s; the float build
+// measures up to about 9e-3 over 20000 steps, the double build about 1e-11
+#ifdef MATH_UTIL_DOUBLE
+#define REPROCESS_TOLERANCE 1e-8
+#else
+#define REPROCESS_TOLERANCE 0.02
+#endif
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+    int num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int num_steps = REPROCESS_DEFAULT_STEPS;
+    unsigned long seed = 1;
+    int force_scan = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "fj:n:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            force_scan = 1;
+            break;
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'n':
+            num_steps = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-f] [-j threads] [-n steps] [-s seed] [log.csv]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    flight_log_t log;
+    if (optind < argc ? !flight_log_read_csv(&log, argv[optind]) : !flight_sim_generate(&log, num_steps, seed))
+        return 1;
+
+    kalman_tuning_t tuning;
+    kf6_t initial, kf;
+    int errorcode = 0;
+    kalman_default_tuning(&tuning);
+    kalman_model_init(&initial, &tuning);
+
+    real_t *x_sequential = malloc((size_t)log.num_steps * dimState * sizeof(real_t));
+    real_t *x_scan = malloc((size_t)log.num_steps * dimState * sizeof(real_t));
+    if (x_sequential == NULL || x_scan == NULL)
+    {
+        fprintf(stderr, "reprocess: out of memory\n");
+        return 1;
+    }
+
+    double start = now_seconds();
+    kf = initial;
+    for (int k = 0; k < log.num_steps; k++)
+    {
+        flight_step_t *step = &log.steps[k];
+        if (!kalman_step(&kf, &tuning, step->ak, step->zk, step->pressure, &errorcode))
+            return 1;
+        for (int i = 0; i < dimState; i++)
+            x_sequential[k * dimState + i] = kf.x[i];
+    }
+    double sequential_time = now_seconds() - start;
+
+    printf("%d steps\n", log.num_steps);
+    printf("sequential filter    %8.2f ms\n", sequential_time * 1e3);
+    if (num_threads < KALMAN_SCAN_BREAK_EVEN_THREADS && !force_scan)
+    {
+        printf("scan skipped, it is slower than the sequential filter below %d threads\n",
+               KALMAN_SCAN_BREAK_EVEN_THREADS);
+        free(x_sequential);
+        free(x_scan);
+        flight_log_free(&log);
+        return 0;
+    }
+
+    start = now_seconds();
+    if (!kalman_scan_filter(&initial, &tuning, &log, num_threads, x_scan, NULL, &errorcode))
+        return 1;
+    double scan_time = now_seconds() - start;
+
+    real_t max_diff = 0;
+    for (int j = 0; j < log.num_steps * dimState; j++)
+    {
+        real_t d = real_abs(x_scan[j] - x_sequential[j]);
+        if (d > max_diff)
+            max_diff = d;
+    }
+
+    printf("scan, %3d threads    %8.2f ms\n", num_threads, scan_time * 1e3);
+    int ok = (double)max_diff <= REPROCESS_TOLERANCE;
+    printf("max |x_scan - x_sequential| = %g, tolerance %g: %s\n", (double)max_diff, REPROCESS_TOLERANCE,
+           ok ? "ok" : "FAIL");
+
+    free(x_sequential);
+    free(x_scan);
+    flight_log_free(&log);
+    return ok ? 0 : 1;
+}
@@ -16,6 +16,11 @@ float altitude(float pressure)
     return (R_g * T0) / (M * g) * (logf(P0 / pressure));
 }
 
+float pressure_at_altitude(float altitude_m)
+{
+    return P0 * expf(-altitude_m * (M * g) / (R_g * T0));
+}
+
 /**
  * Calculates the variance of the accelerometer measurement in the earth reference frame
    Calculation is based on the quaternion product
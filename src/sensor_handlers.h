@@ -1,3 +1,6 @@
+#ifndef SENSOR_HANDLERS_H
+#define SENSOR_HANDLERS_H
+
 
 #define accelerometer_variance 0.35f * 0.35f
 
@@ -24,4 +27,12 @@ typedef struct quaternion {
     float r3;
 } quaternion_t;
 
-float barometer_altitude_variance(float pressure);
\ No newline at end of file
+float barometer_altitude_variance(float pressure);
+
+/** altitude in meters above the reference pressure level P0 */
+float altitude(float pressure);
+
+/** pressure in Pa at the given altitude, the inverse of altitude() */
+float pressure_at_altitude(float altitude_m);
+
+#endif
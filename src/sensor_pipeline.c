@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "kalman_filter.h"
+#include "kalman_checkpoint.h"
+#include "sensor_pipeline.h"
+
+// how long the filter thread sleeps when both rings are empty
+#define PIPELINE_IDLE_SLEEP_NS 100000L
+
+/**
+ * Generates push, peek, pop and pop_batch for a ring type prefix_ring_t
+ * holding prefix_sample_t.
+ *
+ * head is only written by the consumer and tail only by the producer. The
+ * release store of tail publishes the slot contents to the consumer, the
+ * release store of head hands the slot back to the producer.
+ */
+#define DEFINE_SPSC_RING_OPS(prefix)                                                                     \
+    static inline int prefix##_ring_push(prefix##_ring_t *ring, const prefix##_sample_t *sample)         \
+    {                                                                                                    \
+        unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);                         \
+        unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);                         \
+        if (tail - head == PIPELINE_RING_CAPACITY)                                                       \
+            return 0;                                                                                    \
+        ring->slots[tail & (PIPELINE_RING_CAPACITY - 1)] = *sample;                                      \
+        atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);                              \
+        return 1;                                                                                        \
+    }                                                                                                    \
+                                                                                                         \
+    static inline int prefix##_ring_peek(prefix##_ring_t *ring, prefix##_sample_t *sample)               \
+    {                                                                                                    \
+        unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);                         \
+        unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);                         \
+        if (head == tail)                                                                                \
+            return 0;                                                                                    \
+        *sample = ring->slots[head & (PIPELINE_RING_CAPACITY - 1)];                                      \
+        return 1;                                                                                        \
+    }                                                                                                    \
+                                                                                                         \
+    static inline void prefix##_ring_pop(prefix##_ring_t *ring)                                          \
+    {                                                                                                    \
+        unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);                         \
+        atomic_store_explicit(&ring->head, head + 1, memory_order_release);                              \
+    }                                                                                                    \
+                                                                                                         \
+    static inline unsigned prefix##_ring_pop_batch(prefix##_ring_t *ring, prefix##_sample_t *batch,      \
+                                                   unsigned max_count)                                   \
+    {                                                                                                    \
+        unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);                         \
+        unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);                         \
+        unsigned count = tail - head;                                                                    \
+        if (count > max_count)                                                                           \
+            count = max_count;                                                                           \
+        for (unsigned i = 0; i < count; i++)                                                             \
+            batch[i] = ring->slots[(head + i) & (PIPELINE_RING_CAPACITY - 1)];                           \
+        atomic_store_explicit(&ring->head, head + count, memory_order_release);                          \
+        return count;                                                                                    \
+    }
+
+DEFINE_SPSC_RING_OPS(accel)
+DEFINE_SPSC_RING_OPS(position)
+DEFINE_SPSC_RING_OPS(frame)
+
+_Static_assert((PIPELINE_RING_CAPACITY & (PIPELINE_RING_CAPACITY - 1)) == 0,
+               "PIPELINE_RING_CAPACITY must be a power of two");
+
+/**
+ * Generates publish and read for a seqlock type prefix_seqlock_t holding a
+ * value of type value_type. One writer, any number of readers; read returns
+ * the even sequence number of the value it copied.
+ */
+#define DEFINE_SEQLOCK_OPS(prefix, value_type)                                                           \
+    static inline void prefix##_publish(prefix##_seqlock_t *lock, const value_type *value)               \
+    {                                                                                                    \
+        unsigned sequence = atomic_load_explicit(&lock->sequence, memory_order_relaxed);                 \
+        /* odd sequence tells readers a write is in progress */                                          \
+        atomic_store_explicit(&lock->sequence, sequence + 1, memory_order_relaxed);                      \
+        atomic_thread_fence(memory_order_release);                                                       \
+        lock->value = *value;                                                                            \
+        atomic_store_explicit(&lock->sequence, sequence + 2, memory_order_release);                      \
+    }                                                                                                    \
+                                                                                                         \
+    static inline unsigned prefix##_read(prefix##_seqlock_t *lock, value_type *value)                    \
+    {                                                                                                    \
+        unsigned before, after;                                                                          \
+        do                                                                                               \
+        {                                                                                                \
+            before = atomic_load_explicit(&lock->sequence, memory_order_acquire);                        \
+            *value = lock->value;                                                                        \
+            atomic_thread_fence(memory_order_acquire);                                                   \
+            after = atomic_load_explicit(&lock->sequence, memory_order_relaxed);                         \
+        } while ((before & 1u) || before != after);                                                      \
+        return before;                                                                                   \
+    }
+
+DEFINE_SEQLOCK_OPS(snapshot, filter_snapshot_t)
+DEFINE_SEQLOCK_OPS(checkpoint, pipeline_checkpoint_t)
+
+void pipeline_read_snapshot(sensor_pipeline_t *pipeline, filter_snapshot_t *snapshot)
+{
+    snapshot_read(&pipeline->published, snapshot);
+}
+
+static double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Consume every acceleration up to timestamp into latest_accel. Returns 1
+ * once the accel stream has reached timestamp: the newest consumed sample is
+ * at or after it, or the next one in the ring is later.
+ */
+static int accel_catch_up(accel_ring_t *ring, double timestamp, real_t *latest_accel, double *latest_time)
+{
+    accel_sample_t next;
+    while (accel_ring_peek(ring, &next))
+    {
+        if (next.timestamp > timestamp)
+            return 1;
+        for (int i = 0; i < numColB; i++)
+            latest_accel[i] = next.a[i];
+        *latest_time = next.timestamp;
+        accel_ring_pop(ring);
+    }
+    return *latest_time >= timestamp;
+}
+
+static void *filter_thread_main(void *arg)
+{
+    sensor_pipeline_t *pipeline = arg;
+    position_sample_t batch[PIPELINE_BATCH_SIZE];
+    filter_snapshot_t snapshot = {0};
+    pipeline_checkpoint_t checkpoint;
+
+    // the acceleration is held at its latest value between accel samples
+    real_t latest_accel[numColB] = {0};
+    double latest_accel_time = -1e300;
+    vector_t ak = {numColB, latest_accel};
+    struct timespec idle = {0, PIPELINE_IDLE_SLEEP_NS};
+
+    for (;;)
+    {
+        int running = atomic_load_explicit(&pipeline->running, memory_order_acquire);
+        unsigned count = position_ring_pop_batch(&pipeline->position, batch, PIPELINE_BATCH_SIZE);
+        if (count == 0)
+        {
+            if (!running)
+                break;
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        for (unsigned s = 0; s < count; s++)
+        {
+            // hold the measurement until the accel stream has caught up,
+            // unless the pipeline is stopping and no more samples will come
+            if (!accel_catch_up(&pipeline->accel, batch[s].timestamp, latest_accel, &latest_accel_time))
+            {
+                double deadline = monotonic_seconds() + (double)PIPELINE_ACCEL_TIMEOUT_NS * 1e-9;
+                int caught_up = 0;
+                while (atomic_load_explicit(&pipeline->running, memory_order_acquire) &&
+                       monotonic_seconds() < deadline)
+                {
+                    nanosleep(&idle, NULL);
+                    if ((caught_up = accel_catch_up(&pipeline->accel, batch[s].timestamp, latest_accel,
+                                                    &latest_accel_time)))
+                        break;
+                }
+                if (!caught_up)
+                    atomic_fetch_add_explicit(&pipeline->accel_timeouts, 1ul, memory_order_relaxed);
+            }
+
+            real_t z[numRowH];
+            for (int i = 0; i < numRowH; i++)
+                z[i] = batch[s].z[i];
+            vector_t zk = {numRowH, z};
+            int errorcode = 0;
+            KF_one_iteration(&ak, &zk, batch[s].pressure, &errorcode);
+
+            snapshot.timestamp = batch[s].timestamp;
+            snapshot.iteration++;
+            snapshot.errorcode = errorcode;
+            for (int i = 0; i < dimState; i++)
+            {
+                snapshot.x[i] = (float)filter_state.x[i];
+                snapshot.P_diag[i] = (float)filter_state.P[i * dimState + i];
+            }
+            snapshot_publish(&pipeline->published, &snapshot);
+
+            if (pipeline->telemetry != NULL)
+            {
+                telemetry_frame_t frame;
+                telemetry_frame_from_filter(&frame, &filter_state, (uint32_t)snapshot.iteration);
+                if (!frame_ring_push(&pipeline->frames, &frame))
+                    atomic_fetch_add_explicit(&pipeline->telemetry_dropped, 1ul, memory_order_relaxed);
+            }
+
+            if (pipeline->checkpoint_path != NULL && snapshot.iteration % PIPELINE_CHECKPOINT_INTERVAL == 0)
+            {
+                checkpoint.timestamp = snapshot.timestamp;
+                checkpoint.kf = filter_state;
+                checkpoint.tuning = kalman_tuning;
+                checkpoint_publish(&pipeline->checkpoint, &checkpoint);
+            }
+        }
+    }
+
+    // the final state is checkpointed by the I/O thread once this returns
+    if (pipeline->checkpoint_path != NULL && snapshot.iteration > 0)
+    {
+        checkpoint.timestamp = snapshot.timestamp;
+        checkpoint.kf = filter_state;
+        checkpoint.tuning = kalman_tuning;
+        checkpoint_publish(&pipeline->checkpoint, &checkpoint);
+    }
+    return NULL;
+}
+
+// save the published checkpoint if it is newer than the last one saved
+static void io_save_checkpoint(sensor_pipeline_t *pipeline, unsigned *saved_sequence)
+{
+    unsigned sequence = atomic_load_explicit(&pipeline->checkpoint.sequence, memory_order_acquire);
+    if (sequence == *saved_sequence)
+        return;
+
+    pipeline_checkpoint_t checkpoint;
+    *saved_sequence = checkpoint_read(&pipeline->checkpoint, &checkpoint);
+    kalman_checkpoint_save(pipeline->checkpoint_path, &checkpoint.kf, &checkpoint.tuning, checkpoint.timestamp);
+}
+
+static void *io_thread_main(void *arg)
+{
+    sensor_pipeline_t *pipeline = arg;
+    frame_sample_t batch[PIPELINE_BATCH_SIZE];
+    unsigned saved_sequence = 0;
+    struct timespec idle = {0, PIPELINE_IDLE_SLEEP_NS};
+
+    for (;;)
+    {
+        // read before draining, everything the filter handed over before it
+        // finished is then drained in this pass
+        int running = atomic_load_explicit(&pipeline->io_running, memory_order_acquire);
+        unsigned count = frame_ring_pop_batch(&pipeline->frames, batch, PIPELINE_BATCH_SIZE);
+        for (unsigned f = 0; f < count; f++)
+            telemetry_write(pipeline->telemetry, &batch[f]);
+        if (pipeline->checkpoint_path != NULL)
+            io_save_checkpoint(pipeline, &saved_sequence);
+
+        if (count == 0)
+        {
+            if (!running)
+                break;
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    if (pipeline->telemetry != NULL)
+        telemetry_flush(pipeline->telemetry);
+    return NULL;
+}
+
+int pipeline_start(sensor_pipeline_t *pipeline)
+{
+    atomic_init(&pipeline->accel.head, 0u);
+    atomic_init(&pipeline->accel.tail, 0u);
+    atomic_init(&pipeline->position.head, 0u);
+    atomic_init(&pipeline->position.tail, 0u);
+    atomic_init(&pipeline->frames.head, 0u);
+    atomic_init(&pipeline->frames.tail, 0u);
+    atomic_init(&pipeline->published.sequence, 0u);
+    atomic_init(&pipeline->checkpoint.sequence, 0u);
+    atomic_init(&pipeline->dropped, 0ul);
+    atomic_init(&pipeline->accel_timeouts, 0ul);
+    atomic_init(&pipeline->telemetry_dropped, 0ul);
+    atomic_init(&pipeline->running, 1);
+    atomic_init(&pipeline->io_running, 1);
+
+    kalman_filter_init();
+    filter_snapshot_t initial = {0};
+    if (pipeline->checkpoint_path != NULL && access(pipeline->checkpoint_path, R_OK) == 0)
+    {
+        kalman_tuning_t tuning;
+        if (kalman_checkpoint_restore(pipeline->checkpoint_path, &filter_state, &tuning, &initial.timestamp))
+            kalman_set_tuning(&tuning);
+        else
+            kalman_filter_init();
+    }
+    for (int i = 0; i < dimState; i++)
+    {
+        initial.x[i] = (float)filter_state.x[i];
+        initial.P_diag[i] = (float)filter_state.P[i * dimState + i];
+    }
+    pipeline->published.value = initial;
+
+    int io = pipeline->checkpoint_path != NULL || pipeline->telemetry != NULL;
+    if (io && pthread_create(&pipeline->io_thread, NULL, io_thread_main, pipeline) != 0)
+    {
+        fprintf(stderr, "pipeline: could not start the I/O thread\n");
+        return 0;
+    }
+    if (pthread_create(&pipeline->filter_thread, NULL, filter_thread_main, pipeline) != 0)
+    {
+        fprintf(stderr, "pipeline: could not start the filter thread\n");
+        if (io)
+        {
+            atomic_store_explicit(&pipeline->io_running, 0, memory_order_release);
+            pthread_join(pipeline->io_thread, NULL);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+void pipeline_stop(sensor_pipeline_t *pipeline)
+{
+    atomic_store_explicit(&pipeline->running, 0, memory_order_release);
+    pthread_join(pipeline->filter_thread, NULL);
+    if (pipeline->checkpoint_path != NULL || pipeline->telemetry != NULL)
+    {
+        atomic_store_explicit(&pipeline->io_running, 0, memory_order_release);
+        pthread_join(pipeline->io_thread, NULL);
+    }
+}
+
+int pipeline_push_accel(sensor_pipeline_t *pipeline, const accel_sample_t *sample)
+{
+    if (!accel_ring_push(&pipeline->accel, sample))
+    {
+        atomic_fetch_add_explicit(&pipeline->dropped, 1ul, memory_order_relaxed);
+        return 0;
+    }
+    return 1;
+}
+
+int pipeline_push_position(sensor_pipeline_t *pipeline, const position_sample_t *sample)
+{
+    if (!position_ring_push(&pipeline->position, sample))
+    {
+        atomic_fetch_add_explicit(&pipeline->dropped, 1ul, memory_order_relaxed);
+        return 0;
+    }
+    return 1;
+}
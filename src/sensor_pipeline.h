@@ -0,0 +1,182 @@
+#ifndef SENSOR_PIPELINE_H
+#define SENSOR_PIPELINE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "kalman_config.h"
+#include "telemetry.h"
+
+/*
+ * Sensor ingest pipeline for host deployments.
+ *
+ * Sensor reader threads push timestamped samples into single-producer
+ * single-consumer ring buffers, one ring per producer thread. A dedicated
+ * filter thread drains the rings in batches, runs KF_one_iteration for every
+ * position sample and publishes the resulting state through a seqlock, so
+ * readers never block the filter and the filter never waits on I/O.
+ *
+ * A position sample is held until the accelerometer stream has reached its
+ * timestamp, so the predict uses the acceleration that was valid at that
+ * time. If no accel sample at or after the position timestamp arrives within
+ * PIPELINE_ACCEL_TIMEOUT_NS the filter goes on with the newest one it has
+ * and counts the sample in accel_timeouts.
+ *
+ * Pushing never blocks, a full ring rejects the sample and counts it as
+ * dropped.
+ *
+ * Checkpoints and telemetry are written by a separate I/O thread, started
+ * only when one of them is enabled. The filter thread hands it telemetry
+ * frames through another SPSC ring, frames that do not fit are counted in
+ * telemetry_dropped, and checkpoint state through a seqlock.
+ *
+ * If checkpoint_path is set the filter resumes from that checkpoint when one
+ * exists and saves a new one every PIPELINE_CHECKPOINT_INTERVAL iterations
+ * and when the pipeline stops.
+ *
+ * If telemetry is set a telemetry frame is encoded after every iteration
+ * into that writer, which is flushed when the pipeline stops.
+ */
+
+// number of slots per ring, must be a power of two
+#ifndef PIPELINE_RING_CAPACITY
+#define PIPELINE_RING_CAPACITY 256
+#endif
+
+// maximum number of position samples handled per drain of the ring
+#ifndef PIPELINE_BATCH_SIZE
+#define PIPELINE_BATCH_SIZE 32
+#endif
+
+// longest time a position sample waits for the accel stream to catch up
+#ifndef PIPELINE_ACCEL_TIMEOUT_NS
+#define PIPELINE_ACCEL_TIMEOUT_NS 5000000L
+#endif
+
+// filter iterations between two checkpoints
+#ifndef PIPELINE_CHECKPOINT_INTERVAL
+#define PIPELINE_CHECKPOINT_INTERVAL 100
+#endif
+
+#define PIPELINE_CACHE_LINE 64
+
+// earth frame acceleration in m/s^2
+typedef struct accel_sample
+{
+    double timestamp;
+    float a[numColB];
+} accel_sample_t;
+
+// GNSS x, y and barometer altitude in meters, plus the raw pressure
+typedef struct position_sample
+{
+    double timestamp;
+    float z[numRowH];
+    float pressure;
+} position_sample_t;
+
+// filter output published after every iteration
+typedef struct filter_snapshot
+{
+    double timestamp;
+    unsigned long iteration;
+    int errorcode;
+    float x[dimState];
+    float P_diag[dimState];
+} filter_snapshot_t;
+
+typedef struct accel_ring
+{
+    _Alignas(PIPELINE_CACHE_LINE) atomic_uint head; // written by the consumer
+    _Alignas(PIPELINE_CACHE_LINE) atomic_uint tail; // written by the producer
+    _Alignas(PIPELINE_CACHE_LINE) accel_sample_t slots[PIPELINE_RING_CAPACITY];
+} accel_ring_t;
+
+typedef struct position_ring
+{
+    _Alignas(PIPELINE_CACHE_LINE) atomic_uint head;
+    _Alignas(PIPELINE_CACHE_LINE) atomic_uint tail;
+    _Alignas(PIPELINE_CACHE_LINE) position_sample_t slots[PIPELINE_RING_CAPACITY];
+} position_ring_t;
+
+// telemetry frames on their way to the I/O thread
+typedef telemetry_frame_t frame_sample_t;
+
+typedef struct frame_ring
+{
+    _Alignas(PIPELINE_CACHE_LINE) atomic_uint head;
+    _Alignas(PIPELINE_CACHE_LINE) atomic_uint tail;
+    _Alignas(PIPELINE_CACHE_LINE) frame_sample_t slots[PIPELINE_RING_CAPACITY];
+} frame_ring_t;
+
+// filter state handed to the I/O thread for the next checkpoint
+typedef struct pipeline_checkpoint
+{
+    double timestamp;
+    kf6_t kf;
+    kalman_tuning_t tuning;
+} pipeline_checkpoint_t;
+
+typedef struct snapshot_seqlock
+{
+    _Alignas(PIPELINE_CACHE_LINE) atomic_uint sequence; // odd while a write is in progress
+    filter_snapshot_t value;
+} snapshot_seqlock_t;
+
+typedef struct checkpoint_seqlock
+{
+    _Alignas(PIPELINE_CACHE_LINE) atomic_uint sequence;
+    pipeline_checkpoint_t value;
+} checkpoint_seqlock_t;
+
+typedef struct sensor_pipeline
+{
+    accel_ring_t accel;
+    position_ring_t position;
+    snapshot_seqlock_t published;
+    frame_ring_t frames;
+    checkpoint_seqlock_t checkpoint;
+
+    const char *checkpoint_path;   // NULL disables checkpoints
+    telemetry_writer_t *telemetry; // NULL disables telemetry, only used by the I/O thread
+    atomic_ulong dropped;
+    atomic_ulong accel_timeouts;
+    atomic_ulong telemetry_dropped;
+    atomic_int running;    // cleared to stop the filter thread
+    atomic_int io_running; // cleared to stop the I/O thread once the filter thread is done
+    pthread_t filter_thread;
+    pthread_t io_thread;
+} sensor_pipeline_t;
+
+/**
+ * Initialize the filter, or restore it from checkpoint_path, and start the
+ * filter thread and, with checkpoints or telemetry, the I/O thread. Set
+ * checkpoint_path and telemetry before calling.
+ * Returns 1 on success and 0 if a thread could not be created.
+ */
+int pipeline_start(sensor_pipeline_t *pipeline);
+
+/**
+ * Stop the filter thread after it has drained what is left in the rings,
+ * then the I/O thread after the last checkpoint and telemetry flush.
+ */
+void pipeline_stop(sensor_pipeline_t *pipeline);
+
+/**
+ * Push a sample from the single accelerometer reader thread.
+ * Returns 0 if the ring is full and the sample was dropped.
+ */
+int pipeline_push_accel(sensor_pipeline_t *pipeline, const accel_sample_t *sample);
+
+/**
+ * Push a sample from the single GNSS/barometer reader thread.
+ * Returns 0 if the ring is full and the sample was dropped.
+ */
+int pipeline_push_position(sensor_pipeline_t *pipeline, const position_sample_t *sample);
+
+/**
+ * Copy the most recently published filter state into snapshot.
+ * Safe to call from any number of threads.
+ */
+void pipeline_read_snapshot(sensor_pipeline_t *pipeline, filter_snapshot_t *snapshot);
+
+#endif
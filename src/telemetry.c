@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <math.h>
+#include "telemetry.h"
+
+// quantization step of every field, in frame order
+static float field_resolution(int field)
+{
+    if (field < dimState)
+        return TELEMETRY_STATE_RESOLUTION;
+    if (field < 2 * dimState)
+        return TELEMETRY_COVARIANCE_RESOLUTION;
+    return TELEMETRY_RESIDUAL_RESOLUTION;
+}
+
+static void frame_to_fields(const telemetry_frame_t *frame, float *fields)
+{
+    for (int i = 0; i < dimState; i++)
+    {
+        fields[i] = frame->x[i];
+        fields[dimState + i] = frame->P_diag[i];
+    }
+    for (int i = 0; i < numRowH; i++)
+        fields[2 * dimState + i] = frame->yk[i];
+}
+
+static void fields_to_frame(const float *fields, telemetry_frame_t *frame)
+{
+    for (int i = 0; i < dimState; i++)
+    {
+        frame->x[i] = fields[i];
+        frame->P_diag[i] = fields[dimState + i];
+    }
+    for (int i = 0; i < numRowH; i++)
+        frame->yk[i] = fields[2 * dimState + i];
+}
+
+static int32_t quantize(float value, float resolution)
+{
+    float q = roundf(value / resolution);
+    if (!(q > -2147483520.0f)) // also catches NaN
+        return INT32_MIN;
+    if (q > 2147483520.0f)
+        return INT32_MAX;
+    return (int32_t)q;
+}
+
+static size_t put_varint(unsigned char *out, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+static size_t get_varint(const unsigned char *bytes, size_t length, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (size_t n = 0; n < length && n < 10; n++)
+    {
+        result |= (uint64_t)(bytes[n] & 0x7F) << (7 * n);
+        if (!(bytes[n] & 0x80))
+        {
+            *value = result;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+void telemetry_frame_from_filter(telemetry_frame_t *frame, const kf6_t *kf, uint32_t iteration)
+{
+    frame->iteration = iteration;
+    for (int i = 0; i < dimState; i++)
+    {
+        frame->x[i] = (float)kf->x[i];
+        frame->P_diag[i] = (float)kf->P[i * dimState + i];
+    }
+    for (int i = 0; i < numRowH; i++)
+        frame->yk[i] = (float)kf->y[i];
+}
+
+void telemetry_codec_init(telemetry_codec_t *codec)
+{
+    codec->have_previous = 0;
+    codec->frames_since_keyframe = 0;
+    codec->iteration = 0;
+    for (int i = 0; i < TELEMETRY_NUM_FIELDS; i++)
+        codec->values[i] = 0;
+}
+
+size_t telemetry_encode(telemetry_codec_t *encoder, const telemetry_frame_t *frame, unsigned char *out)
+{
+    float fields[TELEMETRY_NUM_FIELDS];
+    int keyframe = !encoder->have_previous || encoder->frames_since_keyframe >= TELEMETRY_KEYFRAME_INTERVAL;
+    size_t n = 0;
+
+    out[n++] = TELEMETRY_SYNC;
+    out[n++] = keyframe ? TELEMETRY_FLAG_KEYFRAME : 0;
+    n += put_varint(&out[n], keyframe ? frame->iteration : frame->iteration - encoder->iteration);
+
+    frame_to_fields(frame, fields);
+    for (int i = 0; i < TELEMETRY_NUM_FIELDS; i++)
+    {
+        int32_t q = quantize(fields[i], field_resolution(i));
+        int64_t reference = keyframe ? 0 : encoder->values[i];
+        n += put_varint(&out[n], zigzag((int64_t)q - reference));
+        encoder->values[i] = q;
+    }
+
+    encoder->have_previous = 1;
+    encoder->frames_since_keyframe = keyframe ? 1 : encoder->frames_since_keyframe + 1;
+    encoder->iteration = frame->iteration;
+    return n;
+}
+
+size_t telemetry_decode(telemetry_codec_t *decoder, const unsigned char *bytes, size_t length,
+                        telemetry_frame_t *frame)
+{
+    float fields[TELEMETRY_NUM_FIELDS];
+    int32_t values[TELEMETRY_NUM_FIELDS];
+    uint64_t raw;
+    size_t n = 2, used;
+
+    if (length < 3 || bytes[0] != TELEMETRY_SYNC)
+        return 0;
+    int keyframe = bytes[1] & TELEMETRY_FLAG_KEYFRAME;
+    if (!keyframe && !decoder->have_previous)
+        return 0;
+
+    if (!(used = get_varint(&bytes[n], length - n, &raw)))
+        return 0;
+    n += used;
+    uint32_t iteration = keyframe ? (uint32_t)raw : decoder->iteration + (uint32_t)raw;
+
+    for (int i = 0; i < TELEMETRY_NUM_FIELDS; i++)
+    {
+        if (!(used = get_varint(&bytes[n], length - n, &raw)))
+            return 0;
+        n += used;
+        int64_t reference = keyframe ? 0 : decoder->values[i];
+        values[i] = (int32_t)(reference + unzigzag(raw));
+        fields[i] = (float)values[i] * field_resolution(i);
+    }
+
+    // only commit to the decoder state once the whole frame is read
+    for (int i = 0; i < TELEMETRY_NUM_FIELDS; i++)
+        decoder->values[i] = values[i];
+    decoder->have_previous = 1;
+    decoder->iteration = iteration;
+
+    frame->iteration = iteration;
+    fields_to_frame(fields, frame);
+    return n;
+}
+
+void telemetry_writer_init(telemetry_writer_t *writer, telemetry_sink_t sink, void *context)
+{
+    telemetry_codec_init(&writer->encoder);
+    writer->sink = sink;
+    writer->context = context;
+    writer->used = 0;
+    writer->frames = 0;
+    writer->bytes = 0;
+}
+
+int telemetry_flush(telemetry_writer_t *writer)
+{
+    if (writer->used == 0)
+        return 1;
+    size_t pending = writer->used;
+    writer->used = 0;
+    if (writer->sink(writer->context, writer->buffer, pending) != pending)
+    {
+        // frames were lost, the next frame must not be a delta against them
+        writer->encoder.have_previous = 0;
+        return 0;
+    }
+    return 1;
+}
+
+int telemetry_write(telemetry_writer_t *writer, const telemetry_frame_t *frame)
+{
+    int ok = 1;
+    if (TELEMETRY_BUFFER_SIZE - writer->used < TELEMETRY_MAX_FRAME_SIZE)
+        ok = telemetry_flush(writer);
+
+    size_t n = telemetry_encode(&writer->encoder, frame, &writer->buffer[writer->used]);
+    writer->used += n;
+    writer->bytes += n;
+    writer->frames++;
+    return ok;
+}
+
+size_t telemetry_file_sink(void *context, const unsigned char *bytes, size_t length)
+{
+    return fwrite(bytes, 1, length, (FILE *)context);
+}
@@ -0,0 +1,112 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "kalman_config.h"
+#include "kalman_filter.h"
+
+/*
+ * Compact binary telemetry of the filter, small enough to log every iteration.
+ *
+ * Every value of a frame is quantized to a fixed resolution, delta encoded
+ * against the previous frame, zigzag mapped and written as a LEB128 varint.
+ * A smoothly moving state therefore costs one or two bytes per value.
+ * Every TELEMETRY_KEYFRAME_INTERVAL frames a keyframe stores absolute
+ * values, so a decoder can start or resynchronize there.
+ *
+ * Frame layout:
+ *   sync byte TELEMETRY_SYNC
+ *   flags byte, bit 0 set for keyframes
+ *   varint iteration, absolute in keyframes, delta otherwise
+ *   TELEMETRY_NUM_FIELDS zigzag varints: x, diagonal of P, yk
+ */
+
+#define TELEMETRY_SYNC 0xA5
+#define TELEMETRY_FLAG_KEYFRAME 0x01
+
+#ifndef TELEMETRY_KEYFRAME_INTERVAL
+#define TELEMETRY_KEYFRAME_INTERVAL 100
+#endif
+
+#ifndef TELEMETRY_BUFFER_SIZE
+#define TELEMETRY_BUFFER_SIZE 4096
+#endif
+
+// quantization steps
+#define TELEMETRY_STATE_RESOLUTION 1e-3f      // 1 mm and 1 mm/s
+#define TELEMETRY_COVARIANCE_RESOLUTION 1e-6f // m^2 and (m/s)^2
+#define TELEMETRY_RESIDUAL_RESOLUTION 1e-3f   // 1 mm
+
+#define TELEMETRY_NUM_FIELDS (dimState + dimState + numRowH)
+
+// sync, flags, a 32 bit varint and 64 bit varints for every field
+#define TELEMETRY_MAX_FRAME_SIZE (2 + 5 + 10 * TELEMETRY_NUM_FIELDS)
+
+typedef struct telemetry_frame
+{
+    uint32_t iteration;
+    float x[dimState];
+    float P_diag[dimState];
+    float yk[numRowH];
+} telemetry_frame_t;
+
+// previous frame, shared layout of the encoder and decoder state
+typedef struct telemetry_codec
+{
+    int have_previous;
+    uint32_t frames_since_keyframe;
+    uint32_t iteration;
+    int32_t values[TELEMETRY_NUM_FIELDS];
+} telemetry_codec_t;
+
+/**
+ * Receives encoded bytes, returns the number of bytes it accepted.
+ */
+typedef size_t (*telemetry_sink_t)(void *context, const unsigned char *bytes, size_t length);
+
+typedef struct telemetry_writer
+{
+    telemetry_codec_t encoder;
+    telemetry_sink_t sink;
+    void *context;
+    size_t used;
+    unsigned long frames;
+    unsigned long bytes;
+    unsigned char buffer[TELEMETRY_BUFFER_SIZE];
+} telemetry_writer_t;
+
+/** Fill frame with the state, covariance diagonal and residuals of kf */
+void telemetry_frame_from_filter(telemetry_frame_t *frame, const kf6_t *kf, uint32_t iteration);
+
+void telemetry_codec_init(telemetry_codec_t *codec);
+
+/**
+ * Encode frame into out, which must hold TELEMETRY_MAX_FRAME_SIZE bytes.
+ * Returns the number of bytes written.
+ */
+size_t telemetry_encode(telemetry_codec_t *encoder, const telemetry_frame_t *frame, unsigned char *out);
+
+/**
+ * Decode one frame from bytes. Returns the number of bytes consumed, or 0
+ * if the input is truncated, malformed or a delta frame arrives before the
+ * first keyframe.
+ */
+size_t telemetry_decode(telemetry_codec_t *decoder, const unsigned char *bytes, size_t length,
+                        telemetry_frame_t *frame);
+
+void telemetry_writer_init(telemetry_writer_t *writer, telemetry_sink_t sink, void *context);
+
+/**
+ * Encode frame into the buffer, handing the buffer to the sink only when it
+ * is full. Returns 0 if the sink did not accept a flush.
+ */
+int telemetry_write(telemetry_writer_t *writer, const telemetry_frame_t *frame);
+
+/** Hand everything buffered to the sink. Returns 0 on a short write. */
+int telemetry_flush(telemetry_writer_t *writer);
+
+/** Sink writing to the stdio FILE * passed as context */
+size_t telemetry_file_sink(void *context, const unsigned char *bytes, size_t length);
+
+#endif
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <string.h>
+#include "telemetry.h"
+
+// decode a telemetry file to CSV on stdout
+//
+// usage: telemetry_dump telemetry.bin
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s telemetry.bin\n", argv[0]);
+        return 1;
+    }
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        perror("telemetry_dump");
+        return 1;
+    }
+
+    static unsigned char buffer[TELEMETRY_BUFFER_SIZE];
+    size_t length = 0, offset = 0, skipped = 0;
+    telemetry_codec_t decoder;
+    telemetry_frame_t frame;
+    telemetry_codec_init(&decoder);
+
+    printf("iteration,x,y,z,vx,vy,vz,Pxx,Pyy,Pzz,Pvxvx,Pvyvy,Pvzvz,yx,yy,yz\n");
+    for (;;)
+    {
+        // keep at least one whole frame in the buffer
+        if (length - offset < TELEMETRY_MAX_FRAME_SIZE)
+        {
+            memmove(buffer, &buffer[offset], length - offset);
+            length -= offset;
+            offset = 0;
+            length += fread(&buffer[length], 1, sizeof(buffer) - length, file);
+            if (length == 0)
+                break;
+        }
+
+        size_t used = telemetry_decode(&decoder, &buffer[offset], length - offset, &frame);
+        if (used == 0)
+        {
+            if (length - offset < TELEMETRY_MAX_FRAME_SIZE && feof(file))
+            {
+                if (length - offset > 0)
+                    skipped += length - offset;
+                break;
+            }
+            // resynchronize on the next keyframe
+            decoder.have_previous = 0;
+            offset++;
+            skipped++;
+            continue;
+        }
+        offset += used;
+
+        printf("%u", frame.iteration);
+        for (int i = 0; i < dimState; i++)
+            printf(",%.3f", (double)frame.x[i]);
+        for (int i = 0; i < dimState; i++)
+            printf(",%.6f", (double)frame.P_diag[i]);
+        for (int i = 0; i < numRowH; i++)
+            printf(",%.3f", (double)frame.yk[i]);
+        printf("\n");
+    }
+
+    fclose(file);
+    if (skipped)
+        fprintf(stderr, "telemetry_dump: skipped %zu undecodable bytes\n", skipped);
+    return 0;
+}
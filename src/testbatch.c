@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "kalman_batch.h"
+#include "kalman_filter.h"
+#include "flight_sim.h"
+#include "testing.h"
+
+/*
+ * Tests of libkalman.so through its public header. This program links the
+ * shared library, so the batch API is checked as a host application sees
+ * it: the estimates must equal kalman_step run over the same flight, a
+ * flight split into several batches must give the same result as one batch,
+ * and invalid arguments must be rejected without touching the filter.
+ */
+
+#define BATCH_STEPS 400
+#define BATCH_SEED 5
+
+typedef struct batch_arrays
+{
+    float accelerations[BATCH_STEPS * KALMAN_BATCH_CONTROL_DIM];
+    float measurements[BATCH_STEPS * KALMAN_BATCH_MEASUREMENT_DIM];
+    float pressures[BATCH_STEPS];
+    float states[BATCH_STEPS * KALMAN_BATCH_STATE_DIM];
+    float P_diag[BATCH_STEPS * KALMAN_BATCH_STATE_DIM];
+} batch_arrays_t;
+
+static void fill_arrays(batch_arrays_t *arrays, const flight_log_t *log)
+{
+    for (int k = 0; k < BATCH_STEPS; k++)
+    {
+        for (int i = 0; i < KALMAN_BATCH_CONTROL_DIM; i++)
+            arrays->accelerations[k * KALMAN_BATCH_CONTROL_DIM + i] = log->steps[k].ak[i];
+        for (int i = 0; i < KALMAN_BATCH_MEASUREMENT_DIM; i++)
+            arrays->measurements[k * KALMAN_BATCH_MEASUREMENT_DIM + i] = log->steps[k].zk[i];
+        arrays->pressures[k] = log->steps[k].pressure;
+    }
+}
+
+// the batch outputs must be kalman_step's state, same code and same order of operations
+static void test_matches_kalman_step(const batch_arrays_t *arrays, const flight_log_t *log,
+                                     const kalman_tuning_t *tuning)
+{
+    kf6_t kf;
+    int errorcode = 0;
+
+    kalman_model_init(&kf, tuning);
+    for (int k = 0; k < BATCH_STEPS; k++)
+    {
+        const flight_step_t *step = &log->steps[k];
+        CHECK(kalman_step(&kf, tuning, step->ak, step->zk, step->pressure, &errorcode));
+        for (int i = 0; i < dimState; i++)
+        {
+            CHECK(arrays->states[k * dimState + i] == real_to_float(kf.x[i]));
+            CHECK(arrays->P_diag[k * dimState + i] == real_to_float(kf.P[i * dimState + i]));
+        }
+    }
+}
+
+static void test_batches(const flight_log_t *log)
+{
+    static batch_arrays_t arrays, split;
+    kalman_batch_tuning_t batch_tuning = {2.0f, 0.5f, 0.1225f, 0.1f, 0.1f};
+    kalman_tuning_t tuning;
+    int32_t errorcode = 0;
+
+    CHECK(kalman_batch_api_version() == KALMAN_BATCH_API_VERSION);
+
+    // one batch over the whole flight with a tuning that is not the default
+    fill_arrays(&arrays, log);
+    kalman_batch_reset(&batch_tuning);
+    CHECK(kalman_process_batch(BATCH_STEPS, arrays.accelerations, arrays.measurements, arrays.pressures,
+                               arrays.states, arrays.P_diag, &errorcode) == BATCH_STEPS);
+    kalman_default_tuning(&tuning);
+    tuning.q_gain = batch_tuning.q_gain;
+    tuning.r_gain = batch_tuning.r_gain;
+    tuning.accel_variance = batch_tuning.accel_variance;
+    tuning.gnss_x_variance = batch_tuning.gnss_x_variance;
+    tuning.gnss_y_variance = batch_tuning.gnss_y_variance;
+    test_matches_kalman_step(&arrays, log, &tuning);
+
+    // the same flight in uneven batches continues the same filter
+    fill_arrays(&split, log);
+    kalman_batch_reset(&batch_tuning);
+    int done = 0;
+    for (int length = 1; done < BATCH_STEPS; length = length * 3 + 1)
+    {
+        int32_t n = length < BATCH_STEPS - done ? length : BATCH_STEPS - done;
+        CHECK(kalman_process_batch(n, &split.accelerations[done * KALMAN_BATCH_CONTROL_DIM],
+                                   &split.measurements[done * KALMAN_BATCH_MEASUREMENT_DIM], &split.pressures[done],
+                                   &split.states[done * KALMAN_BATCH_STATE_DIM], NULL, &errorcode) == n);
+        done += n;
+    }
+    for (int i = 0; i < BATCH_STEPS * KALMAN_BATCH_STATE_DIM; i++)
+        CHECK(split.states[i] == arrays.states[i]);
+}
+
+static void test_invalid_arguments(void)
+{
+    static batch_arrays_t arrays;
+    int32_t errorcode = 0;
+
+    CHECK(kalman_process_batch(-1, arrays.accelerations, arrays.measurements, arrays.pressures, arrays.states,
+                               NULL, &errorcode) == -1);
+    CHECK(errorcode == KALMAN_BATCH_INVALID_ARGUMENT_ERROR);
+    errorcode = 0;
+    CHECK(kalman_process_batch(1, NULL, arrays.measurements, arrays.pressures, arrays.states, NULL,
+                               &errorcode) == -1);
+    CHECK(errorcode == KALMAN_BATCH_INVALID_ARGUMENT_ERROR);
+    errorcode = 0;
+    CHECK(kalman_process_batch(1, arrays.accelerations, arrays.measurements, arrays.pressures, NULL, NULL,
+                               &errorcode) == -1);
+    CHECK(errorcode == KALMAN_BATCH_INVALID_ARGUMENT_ERROR);
+    CHECK(kalman_process_batch(1, arrays.accelerations, arrays.measurements, arrays.pressures, arrays.states,
+                               NULL, NULL) == -1);
+    // an empty batch is not an error
+    errorcode = 0;
+    CHECK(kalman_process_batch(0, arrays.accelerations, arrays.measurements, arrays.pressures, arrays.states,
+                               NULL, &errorcode) == 0);
+    CHECK(errorcode == 0);
+}
+
+int main(void)
+{
+    flight_log_t log;
+
+    CHECK(flight_sim_generate(&log, BATCH_STEPS, BATCH_SEED));
+    if (log.num_steps != BATCH_STEPS)
+        return test_result("testbatch");
+    test_batches(&log);
+    test_invalid_arguments();
+    flight_log_free(&log);
+    return test_result("testbatch");
+}
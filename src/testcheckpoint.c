@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "kalman_checkpoint.h"
+#include "flight_sim.h"
+#include "testing.h"
+
+/*
+ * Tests of kalman_checkpoint: a filter saved after a simulated flight must
+ * restore to exactly the same state, covariance, tuning and timestamp, a
+ * save into another directory must work, and a file
+ * with a damaged byte, a wrong size or a wrong magic must be rejected.
+ */
+
+#define CHECKPOINT_STEPS 500
+#define CHECKPOINT_PATH "testcheckpoint.ckpt"
+
+// the state and tuning of a filter that has run for a while
+static void converged_filter(kf6_t *kf, kalman_tuning_t *tuning)
+{
+    flight_log_t log;
+    int errorcode = 0;
+
+    kalman_default_tuning(tuning);
+    tuning->q_gain = 2.0f; // not the default, so restoring must take it from the file
+    kalman_model_init(kf, tuning);
+    CHECK(flight_sim_generate(&log, CHECKPOINT_STEPS, 3));
+    for (int k = 0; k < log.num_steps; k++)
+    {
+        const flight_step_t *step = &log.steps[k];
+        CHECK(kalman_step(kf, tuning, step->ak, step->zk, step->pressure, &errorcode));
+    }
+    flight_log_free(&log);
+}
+
+// overwrite length bytes of the checkpoint file at offset
+static void damage_file(const char *path, size_t offset, const void *bytes, size_t length)
+{
+    int fd = open(path, O_WRONLY);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return;
+    CHECK(pwrite(fd, bytes, length, (off_t)offset) == (ssize_t)length);
+    CHECK(close(fd) == 0);
+}
+
+static void test_round_trip(const kf6_t *kf, const kalman_tuning_t *tuning)
+{
+    kf6_t restored;
+    kalman_tuning_t restored_tuning;
+    double timestamp = 0.0;
+
+    // a path with a directory part, the directory is synced after the rename
+    CHECK(kalman_checkpoint_save("./" CHECKPOINT_PATH, kf, tuning, 12.5));
+    CHECK(access(CHECKPOINT_PATH ".tmp", F_OK) != 0);
+    CHECK(kalman_checkpoint_restore(CHECKPOINT_PATH, &restored, &restored_tuning, &timestamp));
+
+    // the file stores double, so the state comes back exactly in every build
+    CHECK(timestamp == 12.5);
+    CHECK(restored_tuning.q_gain == tuning->q_gain);
+    CHECK(restored_tuning.r_gain == tuning->r_gain);
+    CHECK(restored_tuning.accel_variance == tuning->accel_variance);
+    for (int i = 0; i < dimState; i++)
+        CHECK(restored.x[i] == kf->x[i]);
+    for (int i = 0; i < dimState * dimState; i++)
+        CHECK(restored.P[i] == kf->P[i]);
+    // the model comes back from the tuning
+    for (int i = 0; i < dimState * dimState; i++)
+    {
+        CHECK(restored.F[i] == kf->F[i]);
+        CHECK(restored.Q[i] == kf->Q[i]);
+    }
+}
+
+static void test_corrupted(const kf6_t *kf, const kalman_tuning_t *tuning)
+{
+    kf6_t restored;
+    kalman_tuning_t restored_tuning;
+    double timestamp = 0.0;
+
+    // one flipped bit in P no longer matches the CRC
+    kalman_checkpoint_t record;
+    kalman_checkpoint_encode(&record, kf, tuning, 1.0);
+    CHECK(kalman_checkpoint_save(CHECKPOINT_PATH, kf, tuning, 1.0));
+    unsigned char flipped = (unsigned char)(((unsigned char *)&record.P[0])[0] ^ 0x01u);
+    damage_file(CHECKPOINT_PATH, offsetof(kalman_checkpoint_t, P), &flipped, 1);
+    CHECK(!kalman_checkpoint_restore(CHECKPOINT_PATH, &restored, &restored_tuning, &timestamp));
+
+    // a damaged checksum field
+    CHECK(kalman_checkpoint_save(CHECKPOINT_PATH, kf, tuning, 1.0));
+    uint32_t checksum = record.checksum ^ 0x80000000u;
+    damage_file(CHECKPOINT_PATH, offsetof(kalman_checkpoint_t, checksum), &checksum, sizeof(checksum));
+    CHECK(!kalman_checkpoint_restore(CHECKPOINT_PATH, &restored, &restored_tuning, &timestamp));
+
+    // wrong magic, e.g. the other byte order
+    CHECK(kalman_checkpoint_save(CHECKPOINT_PATH, kf, tuning, 1.0));
+    uint32_t magic = 0x4b464350u;
+    damage_file(CHECKPOINT_PATH, offsetof(kalman_checkpoint_t, magic), &magic, sizeof(magic));
+    CHECK(!kalman_checkpoint_restore(CHECKPOINT_PATH, &restored, &restored_tuning, &timestamp));
+
+    // a truncated file
+    CHECK(kalman_checkpoint_save(CHECKPOINT_PATH, kf, tuning, 1.0));
+    CHECK(truncate(CHECKPOINT_PATH, (off_t)(sizeof(kalman_checkpoint_t) - 4)) == 0);
+    CHECK(!kalman_checkpoint_restore(CHECKPOINT_PATH, &restored, &restored_tuning, &timestamp));
+
+    // and a missing one
+    unlink(CHECKPOINT_PATH);
+    CHECK(!kalman_checkpoint_restore(CHECKPOINT_PATH, &restored, &restored_tuning, &timestamp));
+}
+
+int main(void)
+{
+    kf6_t kf;
+    kalman_tuning_t tuning;
+
+    converged_filter(&kf, &tuning);
+    test_round_trip(&kf, &tuning);
+    printf("testcheckpoint: corrupted files below must be rejected\n");
+    test_corrupted(&kf, &tuning);
+    unlink(CHECKPOINT_PATH);
+    return test_result("testcheckpoint");
+}
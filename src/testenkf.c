@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "kalman_enkf.h"
+#include "flight_sim.h"
+#include "testing.h"
+
+/*
+ * Tests of the ensemble Kalman filter on a simulated flight with a fixed
+ * seed: the ensemble mean must stay close to kalman_step and be about as
+ * accurate, the same seed must give bit for bit the same ensemble on one and
+ * on several threads, and enkf_free must be safe after a failed enkf_init.
+ */
+
+#define ENKF_TEST_STEPS 1200
+#define ENKF_TEST_MEMBERS 256
+#define ENKF_TEST_THREADS 3 // an uneven split of the groups
+#define ENKF_TEST_SEED 1
+
+// about twice the loss and the deviation measured with seeds 1 to 5: the RMSE
+// of the ensemble mean over that of kalman_step, at most 1.054, and the RMS
+// distance of the ensemble mean from kalman_step, at most 0.19 m
+#define ENKF_TEST_MAX_RMSE_RATIO 1.1
+#define ENKF_TEST_MAX_MEAN_DEVIATION 0.4 // m
+
+static double squared_distance(const real_t *a, const float *b, int first)
+{
+    double se = 0.0;
+    for (int i = first; i < first + 3; i++)
+        se += ((double)a[i] - (double)b[i]) * ((double)a[i] - (double)b[i]);
+    return se;
+}
+
+static void test_against_kalman_step(void)
+{
+    flight_log_t log;
+    kalman_tuning_t tuning;
+    kf6_t kf;
+    enkf_t one, several;
+    int errorcode = 0, identical = 1;
+    double single_se[2] = {0}, enkf_se[2] = {0}, deviation_se = 0.0;
+
+    CHECK(flight_sim_generate(&log, ENKF_TEST_STEPS, ENKF_TEST_SEED));
+    kalman_default_tuning(&tuning);
+    kalman_model_init(&kf, &tuning);
+    CHECK(enkf_init(&one, &tuning, ENKF_TEST_MEMBERS, 1, ENKF_TEST_SEED));
+    CHECK(enkf_init(&several, &tuning, ENKF_TEST_MEMBERS, ENKF_TEST_THREADS, ENKF_TEST_SEED));
+
+    for (int k = 0; k < log.num_steps; k++)
+    {
+        const flight_step_t *step = &log.steps[k];
+        CHECK(kalman_step(&kf, &tuning, step->ak, step->zk, step->pressure, &errorcode));
+        CHECK(enkf_step(&one, step->ak, step->zk, step->pressure, &errorcode));
+        CHECK(enkf_step(&several, step->ak, step->zk, step->pressure, &errorcode));
+
+        identical &= memcmp(one.x_mean, several.x_mean, sizeof(one.x_mean)) == 0 &&
+                     memcmp(one.P, several.P, sizeof(one.P)) == 0;
+        single_se[0] += squared_distance(kf.x, step->truth, 0);
+        single_se[1] += squared_distance(kf.x, step->truth, 3);
+        enkf_se[0] += squared_distance(one.x_mean, step->truth, 0);
+        enkf_se[1] += squared_distance(one.x_mean, step->truth, 3);
+        for (int i = 0; i < 3; i++)
+            deviation_se += ((double)one.x_mean[i] - (double)kf.x[i]) * ((double)one.x_mean[i] - (double)kf.x[i]);
+    }
+    identical &= memcmp(one.x, several.x, (size_t)one.num_members * dimState * sizeof(real_t)) == 0;
+
+    double n = (double)log.num_steps;
+    double position_ratio = sqrt(enkf_se[0] / single_se[0]), velocity_ratio = sqrt(enkf_se[1] / single_se[1]);
+    printf("testenkf: RMSE position %.3f m, velocity %.3f m/s, kalman_step %.3f m, %.3f m/s\n", sqrt(enkf_se[0] / n),
+           sqrt(enkf_se[1] / n), sqrt(single_se[0] / n), sqrt(single_se[1] / n));
+    printf("testenkf: ensemble mean %.3f m from kalman_step, 1 and %d threads %s\n", sqrt(deviation_se / n),
+           several.num_threads, identical ? "identical" : "DIFFER");
+    CHECK(position_ratio < ENKF_TEST_MAX_RMSE_RATIO);
+    CHECK(velocity_ratio < ENKF_TEST_MAX_RMSE_RATIO);
+    CHECK(sqrt(deviation_se / n) < ENKF_TEST_MAX_MEAN_DEVIATION);
+    CHECK(several.num_threads == ENKF_TEST_THREADS);
+    CHECK(identical);
+
+    enkf_free(&one);
+    enkf_free(&several);
+    flight_log_free(&log);
+}
+
+static void test_failed_init(void)
+{
+    kalman_tuning_t tuning;
+    enkf_t enkf;
+
+    kalman_default_tuning(&tuning);
+    CHECK(!enkf_init(&enkf, &tuning, 1, 1, ENKF_TEST_SEED));
+    CHECK(enkf.x == NULL && enkf.rng == NULL && enkf.shared == NULL);
+    enkf_free(&enkf);
+
+    // and twice after a successful one
+    CHECK(enkf_init(&enkf, &tuning, 2, 2, ENKF_TEST_SEED));
+    enkf_free(&enkf);
+    enkf_free(&enkf);
+}
+
+int main(void)
+{
+    test_against_kalman_step();
+    printf("testenkf: an ensemble of one member below must be rejected\n");
+    test_failed_init();
+    return test_result("testenkf");
+}
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <math.h>
+#include "kalman_generic.h"
+#include "testing.h"
+
+/*
+ * Tests of KALMAN_FILTER_DEFINE at other sizes than kf6: a 9-state and a
+ * 15-state filter on a chain model that keeps 3 (position, velocity,
+ * acceleration) or 5 (up to the fourth derivative) derivatives per axis.
+ *
+ * The states are ordered derivative by derivative like kf6, x, y, z of the
+ * position first. The true trajectory is a polynomial the model represents
+ * exactly and the positions are measured without noise, so both filters
+ * must converge onto it. The gain form update and the information form
+ * update must agree on the same prediction, and a sensor of an invalid
+ * dimension must be rejected.
+ */
+
+#define CHAIN_AXES 3
+#define CHAIN_DT 0.1
+#define CHAIN_STEPS 300
+
+// largest relative difference between the gain form and the information
+// form, three times the largest seen at 9 and 15 states; the information
+// form solves with Id + P_pred * Y and never inverts P_pred
+#ifdef MATH_UTIL_DOUBLE
+#define CHAIN_FORM_TOL 1e-13
+#else
+#define CHAIN_FORM_TOL 3e-5
+#endif
+
+KALMAN_FILTER_DEFINE(kf9, 9, 3, 1)
+KALMAN_FILTER_DEFINE(kf15, 15, 3, 1)
+
+// F, H, Q, R and P of a chain model with order derivatives per axis
+static void build_chain_model(real_t *F, real_t *H, real_t *Q, real_t *R, real_t *P, int order)
+{
+    int nx = CHAIN_AXES * order;
+    for (int d = 0; d < order; d++)
+    {
+        for (int e = d; e < order; e++)
+        {
+            // dt^(e - d) / (e - d)!
+            double c = 1.0;
+            for (int i = 1; i <= e - d; i++)
+                c *= CHAIN_DT / i;
+            for (int a = 0; a < CHAIN_AXES; a++)
+                F[(d * CHAIN_AXES + a) * nx + e * CHAIN_AXES + a] = (real_t)c;
+        }
+    }
+    for (int a = 0; a < CHAIN_AXES; a++)
+    {
+        H[a * nx + a] = 1;
+        R[a * CHAIN_AXES + a] = (real_t)0.25;
+        // a little process noise on the highest derivative only
+        Q[((order - 1) * CHAIN_AXES + a) * nx + (order - 1) * CHAIN_AXES + a] = (real_t)1e-6;
+    }
+    for (int i = 0; i < nx; i++)
+        P[i * nx + i] = 100;
+}
+
+// true state at time t, a polynomial of degree order - 1 per axis
+static void chain_truth(double t, int order, double *x)
+{
+    for (int d = 0; d < order; d++)
+    {
+        for (int a = 0; a < CHAIN_AXES; a++)
+        {
+            // derivative d of sum_j c_j t^j / j! with c_j = (a + 1) / (j + 1)
+            double value = 0.0, term = 1.0;
+            for (int j = d; j < order; j++)
+            {
+                value += (a + 1.0) / (j + 1.0) * term;
+                term *= t / (j - d + 1);
+            }
+            x[d * CHAIN_AXES + a] = value;
+        }
+    }
+}
+
+/**
+ * Run the chain model of the given order through one filter instance; name
+ * is an instance created by KALMAN_FILTER_DEFINE(name, 3 * ORDER, 3, 1)
+ */
+#define CHAIN_TEST(name, ORDER)                                                           \
+    static void test_##name(void)                                                         \
+    {                                                                                     \
+        enum { nx = CHAIN_AXES * (ORDER) };                                               \
+        name##_t kf, kf_info;                                                             \
+        real_t u[1] = {0}, z[CHAIN_AXES], x_pred[nx], P_pred[nx * nx];                    \
+        double truth[nx], max_update_diff = 0.0;                                          \
+        int errorcode = 0;                                                                \
+                                                                                          \
+        name##_init(&kf);                                                                 \
+        build_chain_model(kf.F, kf.H, kf.Q, kf.R, kf.P, (ORDER));                         \
+        name##_commit_model(&kf);                                                         \
+                                                                                          \
+        for (int k = 1; k <= CHAIN_STEPS; k++)                                            \
+        {                                                                                 \
+            chain_truth(k * CHAIN_DT, (ORDER), truth);                                    \
+            for (int a = 0; a < CHAIN_AXES; a++)                                          \
+                z[a] = (real_t)truth[a];                                                  \
+                                                                                          \
+            CHECK(name##_predict(&kf, u, x_pred, P_pred, &errorcode));                    \
+            kf_info = kf;                                                                 \
+            CHECK(name##_update(&kf, x_pred, P_pred, z, &errorcode));                     \
+                                                                                          \
+            kalman_sensor_t sensor = {CHAIN_AXES, kf.H, kf.R, z};                         \
+            CHECK(name##_update_information(&kf_info, x_pred, P_pred, &sensor, 1,         \
+                                            &errorcode));                                 \
+            for (int i = 0; i < nx; i++)                                                  \
+            {                                                                             \
+                double d = fabs((double)(kf.x[i] - kf_info.x[i])) /                       \
+                           (1.0 + fabs((double)kf.x[i]));                                 \
+                if (d > max_update_diff)                                                  \
+                    max_update_diff = d;                                                  \
+            }                                                                             \
+        }                                                                                 \
+                                                                                          \
+        double max_pos_error = 0.0, max_vel_error = 0.0;                                  \
+        for (int a = 0; a < CHAIN_AXES; a++)                                              \
+        {                                                                                 \
+            double pe = fabs((double)kf.x[a] - truth[a]) / (1.0 + fabs(truth[a]));        \
+            double ve = fabs((double)kf.x[CHAIN_AXES + a] - truth[CHAIN_AXES + a]) /      \
+                        (1.0 + fabs(truth[CHAIN_AXES + a]));                              \
+            max_pos_error = pe > max_pos_error ? pe : max_pos_error;                      \
+            max_vel_error = ve > max_vel_error ? ve : max_vel_error;                      \
+        }                                                                                 \
+        printf(#name ": relative error position %.1e, velocity %.1e, "                    \
+                     "gain vs information form %.1e\n",                                   \
+               max_pos_error, max_vel_error, max_update_diff);                            \
+        CHECK(max_pos_error < 1e-3);                                                      \
+        CHECK(max_vel_error < 1e-2);                                                      \
+        CHECK(max_update_diff < CHAIN_FORM_TOL);                                          \
+    }
+
+CHAIN_TEST(kf9, 3)
+CHAIN_TEST(kf15, 5)
+
+// a sensor dim outside 1..KALMAN_SENSOR_MAX_DIM is an error, not a stack array of that size
+static void test_sensor_dim(void)
+{
+    real_t H[9] = {1, 0, 0, 0, 0, 0, 0, 0, 0}, R[1] = {1}, z[1] = {0}, Y[9 * 9] = {0}, yv[9] = {0};
+    kalman_sensor_t sensor = {0, H, R, z};
+    int errorcode = 0;
+
+    CHECK(!kalman_information_add(&sensor, 9, Y, yv, &errorcode));
+    CHECK(errorcode == MATMUL_DIMENSION_MISMATCH_ERROR);
+    sensor.dim = KALMAN_SENSOR_MAX_DIM + 1;
+    errorcode = 0;
+    CHECK(!kalman_information_add(&sensor, 9, Y, yv, &errorcode));
+    CHECK(errorcode == MATMUL_DIMENSION_MISMATCH_ERROR);
+    sensor.dim = 1;
+    errorcode = 0;
+    CHECK(kalman_information_add(&sensor, 9, Y, yv, &errorcode));
+    CHECK(errorcode == 0 && Y[0] == 1);
+}
+
+int main(void)
+{
+    test_kf9();
+    test_kf15();
+    test_sensor_dim();
+    return test_result("testfilter");
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <math.h>
+#include "kalman_imm.h"
+#include "flight_sim.h"
+#include "testing.h"
+
+/*
+ * Tests of the IMM bank of imm_init_flight_modes on simulated flights with
+ * fixed seeds: the mode probabilities must follow boost, coast, descent and
+ * the ground, and the combined estimate must be more accurate than
+ * kalman_step on the same flight.
+ */
+
+#define IMM_TEST_STEPS 1200      // past the touchdown around step 1050
+#define IMM_TEST_BOOST_STEPS 40  // 4 s of boost
+#define IMM_TEST_SETTLE_STEPS 3  // steps after a phase change left out of the averages
+#define IMM_TEST_MIN_MU 0.9      // mean probability of the mode of every phase
+
+enum { PHASE_BOOST, PHASE_COAST, PHASE_DESCENT, PHASE_GROUND, NUM_PHASES };
+
+static const int phase_mode[NUM_PHASES] = {IMM_MODE_POWERED, IMM_MODE_BALLISTIC, IMM_MODE_PARACHUTE,
+                                           IMM_MODE_POWERED};
+static const char *phase_name[NUM_PHASES] = {"boost", "coast", "descent", "ground"};
+
+// flight phase of step k from the true state and the phase of step k - 1
+static int flight_phase(const flight_step_t *step, int k, int previous)
+{
+    if (k < IMM_TEST_BOOST_STEPS)
+        return PHASE_BOOST;
+    if (previous <= PHASE_COAST && step->truth[5] > 0.0f)
+        return PHASE_COAST;
+    if (previous <= PHASE_DESCENT && step->truth[2] > 0.0f)
+        return PHASE_DESCENT;
+    return PHASE_GROUND;
+}
+
+static double squared_error(const real_t *x, const float *truth, int first)
+{
+    double se = 0.0;
+    for (int i = first; i < first + 3; i++)
+        se += (double)((x[i] - truth[i]) * (x[i] - truth[i]));
+    return se;
+}
+
+static void test_flight(unsigned long seed)
+{
+    flight_log_t log;
+    kalman_tuning_t tuning;
+    kf6_t kf;
+    static imm_filter_t imm;
+    int errorcode = 0;
+    double mu_sum[NUM_PHASES] = {0}, single_se[2] = {0}, imm_se[2] = {0};
+    int phase_steps[NUM_PHASES] = {0};
+
+    CHECK(flight_sim_generate(&log, IMM_TEST_STEPS, seed));
+    kalman_default_tuning(&tuning);
+    kalman_model_init(&kf, &tuning);
+    CHECK(imm_init_flight_modes(&imm));
+
+    int phase = PHASE_BOOST, since_change = 0;
+    for (int k = 0; k < log.num_steps; k++)
+    {
+        const flight_step_t *step = &log.steps[k];
+        CHECK(kalman_step(&kf, &tuning, step->ak, step->zk, step->pressure, &errorcode));
+        CHECK(imm_step(&imm, step->ak, step->zk, step->pressure, &errorcode));
+
+        single_se[0] += squared_error(kf.x, step->truth, 0);
+        single_se[1] += squared_error(kf.x, step->truth, 3);
+        imm_se[0] += squared_error(imm.x_combined, step->truth, 0);
+        imm_se[1] += squared_error(imm.x_combined, step->truth, 3);
+
+        int next = flight_phase(step, k, phase);
+        since_change = next == phase ? since_change + 1 : 0;
+        phase = next;
+        if (since_change >= IMM_TEST_SETTLE_STEPS)
+        {
+            mu_sum[phase] += (double)imm.mu[phase_mode[phase]];
+            phase_steps[phase]++;
+        }
+    }
+
+    for (int p = 0; p < NUM_PHASES; p++)
+    {
+        double mean_mu = phase_steps[p] ? mu_sum[p] / phase_steps[p] : 0.0;
+        printf("testimm: seed %lu %-7s %4d steps, mean probability of its mode %.3f\n", seed, phase_name[p],
+               phase_steps[p], mean_mu);
+        CHECK(phase_steps[p] > 0);
+        CHECK(mean_mu > IMM_TEST_MIN_MU);
+    }
+
+    double n = (double)log.num_steps;
+    printf("testimm: seed %lu RMSE position %.3f m, velocity %.3f m/s, kalman_step %.3f m, %.3f m/s\n", seed,
+           sqrt(imm_se[0] / n), sqrt(imm_se[1] / n), sqrt(single_se[0] / n), sqrt(single_se[1] / n));
+    CHECK(imm_se[0] < single_se[0]);
+    CHECK(imm_se[1] < single_se[1]);
+    flight_log_free(&log);
+}
+
+static void test_num_modes(void)
+{
+    static imm_filter_t imm;
+    kalman_tuning_t tunings[IMM_LANES + 1];
+    real_t transition[(IMM_LANES + 1) * (IMM_LANES + 1)] = {0};
+
+    for (int i = 0; i <= IMM_LANES; i++)
+        kalman_default_tuning(&tunings[i]);
+    transition[0] = 1;
+    CHECK(imm_init(&imm, tunings, 1, transition));
+    CHECK(!imm_init(&imm, tunings, 0, transition));
+    CHECK(!imm_init(&imm, tunings, IMM_LANES + 1, transition));
+}
+
+int main(void)
+{
+    test_flight(1);
+    test_flight(2);
+    printf("testimm: bank sizes below must be rejected\n");
+    test_num_modes();
+    return test_result("testimm");
+}
@@ -0,0 +1,34 @@
+#ifndef TESTING_H
+#define TESTING_H
+
+#include <stdio.h>
+
+/*
+ * Minimal assertions for the test programs run by make check. A failed
+ * CHECK prints its location and the condition and the test goes on, so one
+ * run reports every failure; test_result gives the exit status.
+ */
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do                                                                               \
+    {                                                                                \
+        if (!(cond))                                                                 \
+        {                                                                            \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                         \
+        }                                                                            \
+    } while (0)
+
+/** print a one line summary and return the exit status of the test program */
+static inline int test_result(const char *name)
+{
+    if (test_failures)
+        printf("%s: %d checks FAILED\n", name, test_failures);
+    else
+        printf("%s: all checks passed\n", name);
+    return test_failures ? 1 : 0;
+}
+
+#endif
@@ -1,17 +1,31 @@
 #include <stdio.h>
 #include "math_util.h"
+#include "testing.h"
+
+// largest allowed element-wise error of the small inverses and products,
+// Q15.16 resolves only 1.5e-5
+#ifdef MATH_UTIL_DOUBLE
+#define MATH_TOL 1e-12
+#elif defined(MATH_UTIL_FIXED)
+#define MATH_TOL 2e-3
+#else
+#define MATH_TOL 1e-5
+#endif
+
+// the size at which matmul switches to matmul_blocked and a bit beyond
+#define BLOCKED_TEST_SIZE (MATMUL_BLOCKED_MIN + 5)
 
 
 // static memory allocations for matrices
-float Id_data[3 * 3] = {0.0f};
-float A_data[3 * 3] = {0.0f};
-float D_data[3 * 3] = {0.0f};
-float invA_data[3 * 3] = {0.0f};
-float T_data[3 * 3] = {0.0f};
-float invT_data[3 * 3] = {0.0f};
+real_t Id_data[3 * 3] = {0};
+real_t A_data[3 * 3] = {0};
+real_t D_data[3 * 3] = {0};
+real_t invA_data[3 * 3] = {0};
+real_t T_data[3 * 3] = {0};
+real_t invT_data[3 * 3] = {0};
 
-float S_data[3 * 3] = {0.0f}; // scratch matrix
-float S2_data[3 * 3] = {0.0f}; // scratch matrix
+real_t S_data[3 * 3] = {0}; // scratch matrix
+real_t S2_data[3 * 3] = {0}; // scratch matrix
 
 matrix_t A, D, invA, Id, T, invT, S, S2;
 
@@ -29,41 +43,147 @@ void initialize()
 
     Id.numRow = 3;
     Id.numCol = 3;
-    set_val(&Id, 0, 0, 1);
-    set_val(&Id, 1, 1, 1);
-    set_val(&Id, 2, 2, 1);
+    set_val(&Id, 0, 0, real_from_float(1));
+    set_val(&Id, 1, 1, real_from_float(1));
+    set_val(&Id, 2, 2, real_from_float(1));
 
     // 
     D.numRow = 3;
     D.numCol = 3;
-    set_val(&D, 0, 0, 5);
-    set_val(&D, 1, 1, 5);
-    set_val(&D, 2, 2, 5);
+    set_val(&D, 0, 0, real_from_float(5));
+    set_val(&D, 1, 1, real_from_float(5));
+    set_val(&D, 2, 2, real_from_float(5));
 
     S.numRow = 3;
     S.numCol = 3;
     S2.numRow = 3;
     S2.numCol = 3;
+    invA.numRow = 3;
+    invA.numCol = 3;
 
 
     // set some linearly independent columns
     // test case: A != inv(A) and A * inv(A) = Id
     A.numRow = 3;
     A.numCol = 3;
-    set_val(&A, 0, 3, 1);
-    set_val(&A, 1, 2, 1);
-    set_val(&A, 2, 1, 1);
+    set_val(&A, 0, 0, real_from_float(1));
+    set_val(&A, 1, 0, real_from_float(1));
+    set_val(&A, 2, 0, real_from_float(1));
 
-    set_val(&A, 0, 1, 1);
-    set_val(&A, 1, 1, 2);
-    set_val(&A, 2, 1, 3);
+    set_val(&A, 0, 1, real_from_float(1));
+    set_val(&A, 1, 1, real_from_float(2));
+    set_val(&A, 2, 1, real_from_float(3));
 
-    set_val(&A, 0, 2, 4);
-    set_val(&A, 1, 2, 0);
-    set_val(&A, 2, 2, -9);
+    set_val(&A, 0, 2, real_from_float(4));
+    set_val(&A, 1, 2, real_from_float(0));
+    set_val(&A, 2, 2, real_from_float(-9));
     
 }
 
+// largest element-wise |a - b|
+static double max_difference(matrix_t *a, matrix_t *b)
+{
+    double worst = 0.0;
+    for (int row = 0; row < a->numRow; row++)
+    {
+        for (int col = 0; col < a->numCol; col++)
+        {
+            double d = (double)real_to_float(real_abs(get_value(a, row, col) - get_value(b, row, col)));
+            worst = d > worst ? d : worst;
+        }
+    }
+    return worst;
+}
+
+static void check_inverses(void)
+{
+    int e = 0;
+    stackMatrixAllocate(inv, 3, 3);
+    stackMatrixAllocate(product, 3, 3);
+
+    // D = 5 * Id
+    CHECK(inv3x3(&D, &inv, &e));
+    CHECK(matmul(&D, &inv, &product, &e));
+    CHECK(max_difference(&product, &Id) < MATH_TOL);
+    real_t fifth = real_div(real_from_float(1), real_from_float(5));
+    CHECK(real_to_float(real_abs(get_value(&inv, 1, 1) - fifth)) < MATH_TOL);
+
+    // A and its inverse by cofactors and by Gauss-Jordan
+    CHECK(inv3x3(&A, &invA, &e));
+    CHECK(matmul(&A, &invA, &product, &e));
+    CHECK(max_difference(&product, &Id) < MATH_TOL);
+    CHECK(max_difference(&A, &invA) > 0.1);
+    CHECK(matinv(&A, &inv, &e));
+    CHECK(max_difference(&inv, &invA) < MATH_TOL);
+
+#ifndef MATH_UTIL_FIXED
+    // a precise sensor, R = 0.01 * Id has det 1e-6 and must still invert
+    // (its determinant is 0 in Q15.16)
+    stackMatrixAllocate(small, 3, 3);
+    clear_matrix(&small);
+    for (int i = 0; i < 3; i++)
+        set_val(&small, i, i, real_div(real_from_float(1), real_from_float(100)));
+    CHECK(inv3x3(&small, &inv, &e));
+    CHECK(real_to_float(real_abs(get_value(&inv, 2, 2) - real_from_float(100))) < 100.0 * MATH_TOL);
+    CHECK(matinv(&small, &inv, &e));
+    CHECK(real_to_float(real_abs(get_value(&inv, 0, 0) - real_from_float(100))) < 100.0 * MATH_TOL);
+#endif
+
+    // the third row is the sum of the first two
+    stackMatrixAllocate(singular, 3, 3);
+    float rows[9] = {1, 2, 3, 0, 1, 4, 1, 3, 7};
+    for (int i = 0; i < 9; i++)
+        singular.data[i] = real_from_float(rows[i]);
+    e = 0;
+    CHECK(!inv3x3(&singular, &inv, &e) && e == MAT_INV_SINGULAR_MATRIX_ERROR);
+    e = 0;
+    CHECK(!matinv(&singular, &inv, &e) && e == MAT_INV_SINGULAR_MATRIX_ERROR);
+}
+
+static void check_products(void)
+{
+    int e = 0;
+    stackMatrixAllocate(At, 3, 3);
+    stackMatrixAllocate(Att, 3, 3);
+    CHECK(transpose(&A, &At, &e));
+    CHECK(get_value(&At, 0, 2) == get_value(&A, 2, 0));
+    CHECK(transpose(&At, &Att, &e));
+    CHECK(max_difference(&Att, &A) == 0.0);
+
+    // shapes that do not fit are rejected
+    stackMatrixAllocate(wide, 3, 4);
+    e = 0;
+    CHECK(!matmul(&A, &A, &wide, &e) && e == MATMUL_DIMENSION_MISMATCH_ERROR);
+
+    // matmul_blocked against a plain triple loop, small integers so every
+    // backend computes the product exactly
+    enum { n = BLOCKED_TEST_SIZE };
+    stackMatrixAllocate(left, n, n);
+    stackMatrixAllocate(right, n, n);
+    stackMatrixAllocate(product, n, n);
+    stackMatrixAllocate(expected, n, n);
+    for (int row = 0; row < n; row++)
+    {
+        for (int col = 0; col < n; col++)
+        {
+            set_val(&left, row, col, real_from_float((float)((row + 2 * col) % 5 - 2)));
+            set_val(&right, row, col, real_from_float((float)((3 * row + col) % 7 - 3)));
+        }
+    }
+    for (int row = 0; row < n; row++)
+    {
+        for (int col = 0; col < n; col++)
+        {
+            float sum = 0.0f;
+            for (int i = 0; i < n; i++)
+                sum += real_to_float(get_value(&left, row, i)) * real_to_float(get_value(&right, i, col));
+            set_val(&expected, row, col, real_from_float(sum));
+        }
+    }
+    CHECK(matmul(&left, &right, &product, &e));
+    CHECK(max_difference(&product, &expected) == 0.0);
+}
+
 int main()
 {
     initialize();
@@ -100,10 +220,9 @@ int main()
     printf("\n");
     printf("A * inv(A): \n");
     pprint_matrix(&S2);
+    printf("\n");
 
-
-
-
-
-
-}
\ No newline at end of file
+    check_inverses();
+    check_products();
+    return test_result("testmath");
+}
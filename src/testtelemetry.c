@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "telemetry.h"
+#include "testing.h"
+
+/*
+ * Tests of the telemetry codec: frames written through a telemetry_writer
+ * must decode to the same values within half a quantization step, across
+ * keyframes, large jumps and sign changes, and malformed input must be
+ * rejected without touching the decoder state.
+ */
+
+#define TELEMETRY_TEST_FRAMES (3 * TELEMETRY_KEYFRAME_INTERVAL + 17)
+#define TELEMETRY_TEST_CAPACITY (TELEMETRY_TEST_FRAMES * TELEMETRY_MAX_FRAME_SIZE)
+
+typedef struct memory_sink
+{
+    size_t used;
+    unsigned char bytes[TELEMETRY_TEST_CAPACITY];
+} memory_sink_t;
+
+static size_t memory_sink(void *context, const unsigned char *bytes, size_t length)
+{
+    memory_sink_t *sink = context;
+    if (length > sizeof(sink->bytes) - sink->used)
+        length = sizeof(sink->bytes) - sink->used;
+    memcpy(&sink->bytes[sink->used], bytes, length);
+    sink->used += length;
+    return length;
+}
+
+// frame k of the test stream: a smooth flight with a few large jumps,
+// sign changes and values near the end of the quantized range
+static void test_frame(telemetry_frame_t *frame, int k)
+{
+    float t = (float)k * 0.01f;
+    frame->iteration = (uint32_t)(k < 50 ? k : 1000000 + k); // a gap in the iterations
+    for (int i = 0; i < dimState; i++)
+    {
+        frame->x[i] = (float)(i + 1) * 10.0f * sinf(t + (float)i);
+        frame->P_diag[i] = 0.5f / (1.0f + t) + 1e-4f * (float)i;
+    }
+    for (int i = 0; i < numRowH; i++)
+        frame->yk[i] = 0.3f * cosf(7.0f * t + (float)i);
+
+    if (k % 97 == 13)
+        frame->x[0] = -frame->x[0] - 5000.0f;
+    if (k == 120)
+        frame->x[2] = 2.0e6f; // about INT32_MAX steps of 1 mm
+    if (k == 121)
+        frame->x[2] = -2.0e6f;
+}
+
+static int close_enough(float decoded, float original, float resolution)
+{
+    return fabsf(decoded - original) <= 0.5f * resolution * (1.0f + 1e-3f) + fabsf(original) * 1e-7f;
+}
+
+static void test_round_trip(void)
+{
+    static telemetry_writer_t writer;
+    static memory_sink_t sink;
+    telemetry_frame_t frame, decoded;
+    telemetry_codec_t decoder;
+
+    sink.used = 0;
+    telemetry_writer_init(&writer, memory_sink, &sink);
+    for (int k = 0; k < TELEMETRY_TEST_FRAMES; k++)
+    {
+        test_frame(&frame, k);
+        CHECK(telemetry_write(&writer, &frame));
+    }
+    CHECK(telemetry_flush(&writer));
+    CHECK(writer.frames == TELEMETRY_TEST_FRAMES);
+    CHECK(writer.bytes == sink.used);
+
+    telemetry_codec_init(&decoder);
+    size_t offset = 0;
+    int keyframes = 0;
+    for (int k = 0; k < TELEMETRY_TEST_FRAMES; k++)
+    {
+        keyframes += (sink.bytes[offset + 1] & TELEMETRY_FLAG_KEYFRAME) != 0;
+        size_t used = telemetry_decode(&decoder, &sink.bytes[offset], sink.used - offset, &decoded);
+        CHECK(used > 0 && used <= TELEMETRY_MAX_FRAME_SIZE);
+        if (used == 0)
+            return;
+        offset += used;
+
+        test_frame(&frame, k);
+        CHECK(decoded.iteration == frame.iteration);
+        for (int i = 0; i < dimState; i++)
+        {
+            CHECK(close_enough(decoded.x[i], frame.x[i], TELEMETRY_STATE_RESOLUTION));
+            CHECK(close_enough(decoded.P_diag[i], frame.P_diag[i], TELEMETRY_COVARIANCE_RESOLUTION));
+        }
+        for (int i = 0; i < numRowH; i++)
+            CHECK(close_enough(decoded.yk[i], frame.yk[i], TELEMETRY_RESIDUAL_RESOLUTION));
+    }
+    CHECK(offset == sink.used);
+    CHECK(keyframes == (TELEMETRY_TEST_FRAMES + TELEMETRY_KEYFRAME_INTERVAL - 1) / TELEMETRY_KEYFRAME_INTERVAL);
+}
+
+static void test_malformed(void)
+{
+    telemetry_codec_t encoder, decoder;
+    telemetry_frame_t frame, decoded;
+    unsigned char keyframe[TELEMETRY_MAX_FRAME_SIZE], delta[TELEMETRY_MAX_FRAME_SIZE];
+
+    telemetry_codec_init(&encoder);
+    test_frame(&frame, 1);
+    size_t keyframe_size = telemetry_encode(&encoder, &frame, keyframe);
+    test_frame(&frame, 2);
+    size_t delta_size = telemetry_encode(&encoder, &frame, delta);
+
+    // a delta frame before any keyframe
+    telemetry_codec_init(&decoder);
+    CHECK(telemetry_decode(&decoder, delta, delta_size, &decoded) == 0);
+
+    // a truncated frame, and one with a broken sync byte
+    CHECK(telemetry_decode(&decoder, keyframe, keyframe_size - 1, &decoded) == 0);
+    keyframe[0] ^= 0xFF;
+    CHECK(telemetry_decode(&decoder, keyframe, keyframe_size, &decoded) == 0);
+    keyframe[0] ^= 0xFF;
+    CHECK(!decoder.have_previous);
+
+    // after the keyframe the delta frame decodes
+    CHECK(telemetry_decode(&decoder, keyframe, keyframe_size, &decoded) == keyframe_size);
+    CHECK(telemetry_decode(&decoder, delta, delta_size, &decoded) == delta_size);
+    CHECK(decoded.iteration == frame.iteration);
+}
+
+int main(void)
+{
+    test_round_trip();
+    test_malformed();
+    return test_result("testtelemetry");
+}
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "kalman_filter.h"
+#include "flight_sim.h"
+
+/*
+ * Tuning sweep: run one filter per candidate tuning over the same flights
+ * and report position RMSE, velocity RMSE and the average normalized
+ * estimation error squared per candidate.
+ *
+ * Simulated flights use -m noise realizations (seeds seed, seed + 1, ...),
+ * so the average NEES over runs and steps is the Monte Carlo ANEES, ideally
+ * close to dimState. A recorded log is a single realization, its column is
+ * then the time average of the NEES and labelled mean_nees.
+ *
+ * A candidate whose filter fails is ranked last, its errors cover the steps
+ * it completed. Candidates are spread over worker threads, one per core by
+ * default.
+ *
+ * usage: tuning_sweep [-j threads] [-n steps] [-m runs] [-s seed] [log.csv]
+ */
+
+#define SWEEP_DEFAULT_STEPS 1200
+#define SWEEP_DEFAULT_RUNS 8
+
+typedef struct sweep_result
+{
+    kalman_tuning_t tuning;
+    float position_rmse;
+    float velocity_rmse;
+    float anees;
+    long steps; // steps completed over all runs
+    int failed;
+    int errorcode;
+} sweep_result_t;
+
+typedef struct sweep_job
+{
+    const flight_log_t *logs;
+    int num_logs;
+    sweep_result_t *results;
+    int num_candidates;
+    atomic_int next;
+} sweep_job_t;
+
+static void run_candidate(const flight_log_t *logs, int num_logs, sweep_result_t *result)
+{
+    double position_se = 0.0, velocity_se = 0.0, nees = 0.0;
+    int errorcode = 0;
+    long steps = 0;
+    int failed = 0;
+
+    for (int run = 0; run < num_logs && !failed; run++)
+    {
+        const flight_log_t *log = &logs[run];
+        kf6_t kf;
+        kalman_model_init(&kf, &result->tuning);
+        for (int k = 0; k < log->num_steps; k++)
+        {
+            const flight_step_t *step = &log->steps[k];
+            if (!kalman_step(&kf, &result->tuning, step->ak, step->zk, step->pressure, &errorcode))
+            {
+                failed = 1;
+                break;
+            }
+
+            // NEES = e.T * inv(P) * e with e the estimation error
+            real_t e[dimState], Pinv_e[dimState];
+            stackMatrixAllocate(Pinv, dimState, dimState);
+            matrixView(Pk, kf.P, dimState, dimState);
+            for (int i = 0; i < dimState; i++)
+                e[i] = kf.x[i] - step->truth[i];
+            if (!matinv(&Pk, &Pinv, &errorcode))
+            {
+                failed = 1;
+                break;
+            }
+            kalman_gemm(Pinv.data, e, Pinv_e, dimState, dimState, 1);
+
+            for (int i = 0; i < 3; i++)
+            {
+                position_se += (double)(e[i] * e[i]);
+                velocity_se += (double)(e[i + 3] * e[i + 3]);
+            }
+            for (int i = 0; i < dimState; i++)
+                nees += (double)(e[i] * Pinv_e[i]);
+            steps++;
+        }
+    }
+
+    result->errorcode = errorcode;
+    result->failed = failed;
+    result->steps = steps;
+    // averages over the steps actually taken
+    double n = steps > 0 ? (double)steps : 1.0;
+    result->position_rmse = (float)sqrt(position_se / n);
+    result->velocity_rmse = (float)sqrt(velocity_se / n);
+    result->anees = (float)(nees / n);
+}
+
+static void *sweep_worker(void *arg)
+{
+    sweep_job_t *job = arg;
+    for (;;)
+    {
+        int candidate = atomic_fetch_add(&job->next, 1);
+        if (candidate >= job->num_candidates)
+            break;
+        run_candidate(job->logs, job->num_logs, &job->results[candidate]);
+    }
+    return NULL;
+}
+
+static int compare_rmse(const void *a, const void *b)
+{
+    const sweep_result_t *ra = a, *rb = b;
+    if (ra->failed != rb->failed)
+        return ra->failed ? 1 : -1;
+    return (ra->position_rmse > rb->position_rmse) - (ra->position_rmse < rb->position_rmse);
+}
+
+// candidate grid: each tuning value is the default times one of these scales.
+// Q is proportional to q_gain * accel_variance, so one axis scales q_gain
+// alone; a second axis over accel_variance would only repeat products.
+// r_gain scales the whole R but gnss variance only its GNSS part, so the
+// two axes together set the GNSS and the barometer noise independently
+static const float q_gain_scales[] = {0.05f, 0.1f, 0.3f, 1.0f, 3.0f, 10.0f, 20.0f};
+static const float r_gain_scales[] = {0.5f, 1.0f, 2.0f};
+static const float gnss_variance_scales[] = {0.5f, 1.0f, 2.0f};
+
+#define GRID_LEN(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+static void free_logs(flight_log_t *logs, int num_logs)
+{
+    for (int run = 0; run < num_logs; run++)
+        flight_log_free(&logs[run]);
+    free(logs);
+}
+
+static int build_grid(sweep_result_t *results)
+{
+    kalman_tuning_t base;
+    kalman_default_tuning(&base);
+
+    int n = 0;
+    for (int qi = 0; qi < GRID_LEN(q_gain_scales); qi++)
+        for (int ri = 0; ri < GRID_LEN(r_gain_scales); ri++)
+            for (int gi = 0; gi < GRID_LEN(gnss_variance_scales); gi++)
+            {
+                kalman_tuning_t *t = &results[n++].tuning;
+                *t = base;
+                t->q_gain *= q_gain_scales[qi];
+                t->r_gain *= r_gain_scales[ri];
+                t->gnss_x_variance *= gnss_variance_scales[gi];
+                t->gnss_y_variance *= gnss_variance_scales[gi];
+            }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    int num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int num_steps = SWEEP_DEFAULT_STEPS;
+    int num_runs = SWEEP_DEFAULT_RUNS;
+    unsigned long seed = 1;
+    const char *log_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:n:m:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'n':
+            num_steps = atoi(optarg);
+            break;
+        case 'm':
+            num_runs = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-j threads] [-n steps] [-m runs] [-s seed] [log.csv]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc)
+        log_path = argv[optind];
+    if (num_threads < 1)
+        num_threads = 1;
+    if (num_runs < 1 || log_path != NULL)
+        num_runs = 1;
+
+    flight_log_t *logs = calloc((size_t)num_runs, sizeof(flight_log_t));
+    if (logs == NULL)
+    {
+        fprintf(stderr, "tuning_sweep: out of memory\n");
+        return 1;
+    }
+    for (int run = 0; run < num_runs; run++)
+    {
+        if (log_path ? !flight_log_read_csv(&logs[run], log_path)
+                     : !flight_sim_generate(&logs[run], num_steps, seed + (unsigned long)run))
+        {
+            free_logs(logs, run);
+            return 1;
+        }
+    }
+    if (!logs[0].has_truth)
+    {
+        fprintf(stderr, "tuning_sweep: %s has no truth columns\n", log_path);
+        free_logs(logs, num_runs);
+        return 1;
+    }
+
+    int max_candidates = GRID_LEN(q_gain_scales) * GRID_LEN(r_gain_scales) * GRID_LEN(gnss_variance_scales);
+    sweep_job_t job;
+    job.logs = logs;
+    job.num_logs = num_runs;
+    job.results = calloc((size_t)max_candidates, sizeof(sweep_result_t));
+    pthread_t *threads = malloc((size_t)num_threads * sizeof(pthread_t));
+    if (job.results == NULL || threads == NULL)
+    {
+        fprintf(stderr, "tuning_sweep: out of memory\n");
+        free(threads);
+        free(job.results);
+        free_logs(logs, num_runs);
+        return 1;
+    }
+    job.num_candidates = build_grid(job.results);
+    atomic_init(&job.next, 0);
+
+    // this thread is the first worker, a thread that fails to start only
+    // leaves its share to the others
+    int started = 0;
+    for (int i = 1; i < num_threads; i++)
+    {
+        if (pthread_create(&threads[started], NULL, sweep_worker, &job) != 0)
+        {
+            fprintf(stderr, "tuning_sweep: could only start %d of %d threads\n", started + 1, num_threads);
+            break;
+        }
+        started++;
+    }
+    sweep_worker(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    qsort(job.results, (size_t)job.num_candidates, sizeof(sweep_result_t), compare_rmse);
+
+    printf("%d candidates, %d runs of %d steps, %d threads\n", job.num_candidates, num_runs, logs[0].num_steps,
+           started + 1);
+    printf("%8s %8s %10s %10s %10s %10s %10s %8s %8s\n", "q_gain", "r_gain", "accel_var", "gnss_var",
+           "pos_rmse", "vel_rmse", num_runs > 1 ? "anees" : "mean_nees", "steps", "error");
+    for (int i = 0; i < job.num_candidates; i++)
+    {
+        sweep_result_t *r = &job.results[i];
+        printf("%8.3f %8.3f %10.4f %10.4f %10.4f %10.4f %10.3f %8ld %8d\n",
+               (double)r->tuning.q_gain, (double)r->tuning.r_gain, (double)r->tuning.accel_variance,
+               (double)r->tuning.gnss_x_variance, (double)r->position_rmse, (double)r->velocity_rmse,
+               (double)r->anees, r->steps, r->errorcode);
+    }
+
+    free(threads);
+    free(job.results);
+    free_logs(logs, num_runs);
+    return 0;
+}